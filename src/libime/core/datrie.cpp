@@ -12,6 +12,13 @@
 
 #include "datrie.h"
 #include <sys/types.h>
+#if __has_include(<sys/mman.h>)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define LIBIME_DATRIE_HAS_MMAP
+#endif
 #include <algorithm>
 #include <array>
 #include <bit>
@@ -28,10 +35,12 @@
 #include <memory>
 #include <optional>
 #include <ostream>
+#include <span>
 #include <stdexcept>
 #include <string>
 #include <string_view>
 #include <tuple>
+#include <utility>
 #include <vector>
 #include <fcitx-utils/macros.h>
 #include "endian_p.h"
@@ -106,6 +115,84 @@ void decodeBigEndian(T &data)
     data = std::bit_cast<T>(raw);
 }
 
+// Convert to little endian and read back as big endian, which is always a
+// byte swap regardless of host byte order.
+template <typename T>
+void swapByteOrder(T &data)
+    requires(sizeof(T) == sizeof(uint32_t))
+{
+    auto raw = std::bit_cast<uint32_t>(data);
+    raw = be32toh(htole32(raw));
+    data = std::bit_cast<T>(raw);
+}
+
+template <typename T>
+void swapByteOrder(T &data)
+    requires(sizeof(T) == sizeof(uint16_t))
+{
+    auto raw = std::bit_cast<uint16_t>(data);
+    raw = be16toh(htole16(raw));
+    data = std::bit_cast<T>(raw);
+}
+
+// Image format that can be used directly after mmap.
+// Layout: magic (be32), version (be32), ImageHeader (native), array, ninfo,
+// block, tail. Each section starts at a multiple of imageAlignment, and the
+// image is padded to a multiple of imageAlignment, so an image saved right
+// after another one in the same file is aligned as well.
+constexpr uint32_t imageMagic = 0x000fc7d1;
+constexpr uint32_t imageVersion = 0x1;
+// Same layout, but tail is shared, see DATriePrivate::share_tail.
+constexpr uint32_t imageSharedTailVersion = 0x2;
+// Same layouts as above, followed by the codebook, a native uint32 size and
+// int32 values. Values in tail are codes, see DATriePrivate::quantize.
+constexpr uint32_t imageQuantizedVersion = 0x3;
+constexpr uint32_t imageQuantizedSharedTailVersion = 0x4;
+constexpr uint32_t imageByteOrderTag = 0x01020304;
+constexpr size_t imageAlignment = 8;
+
+// Tail of a leaf is a record of value and offset of the string if the tail
+// reference has this bit.
+constexpr uint32_t sharedTailFlag = 1U << 30;
+
+struct ImageHeader {
+    uint32_t byteOrderTag;
+    uint32_t length;
+    uint32_t size;
+    int32_t bheadF;
+    int32_t bheadC;
+    int32_t bheadO;
+
+    bool isNative() const { return byteOrderTag == imageByteOrderTag; }
+
+    bool isSwapped() const {
+        auto tag = byteOrderTag;
+        swapByteOrder(tag);
+        return tag == imageByteOrderTag;
+    }
+
+    void swap() {
+        swapByteOrder(byteOrderTag);
+        swapByteOrder(length);
+        swapByteOrder(size);
+        swapByteOrder(bheadF);
+        swapByteOrder(bheadC);
+        swapByteOrder(bheadO);
+    }
+};
+
+static_assert(sizeof(ImageHeader) == 24);
+
+constexpr size_t alignImageOffset(size_t offset) {
+    return (offset + imageAlignment - 1) / imageAlignment * imageAlignment;
+}
+
+inline void prefetch([[maybe_unused]] const void *addr) {
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_prefetch(addr);
+#endif
+}
+
 } // namespace
 
 // template<typename T>
@@ -129,6 +216,10 @@ public:
 
     static constexpr size_t MAX_ALLOC_SIZE = 1
                                              << 16; // must be divisible by 256
+    // Number of Closed blocks to try when placing children in build.
+    static constexpr int MAX_DENSE_TRIAL = 16;
+    // Number of lookups interleaved by find_batch.
+    static constexpr size_t MAX_BATCH_LOOKUP = 16;
     using result_type = value_type;
     using uchar = uint8_t;
     static_assert(sizeof(value_type) <= sizeof(int32_t),
@@ -154,6 +245,11 @@ public:
             decodeBigEndian(check);
         }
 
+        void swap() {
+            swapByteOrder(base);
+            swapByteOrder(check);
+        }
+
         friend std::ostream &operator<<(std::ostream &out, const node &n) {
             marshall(out, n.base) && marshall(out, n.check);
             return out;
@@ -212,6 +308,15 @@ public:
             decodeBigEndian(ehead);
         }
 
+        void swap() {
+            swapByteOrder(prev);
+            swapByteOrder(next);
+            swapByteOrder(num);
+            swapByteOrder(reject);
+            swapByteOrder(trial);
+            swapByteOrder(ehead);
+        }
+
         friend std::ostream &operator<<(std::ostream &out, const block &b) {
             marshall(out, b.prev) && marshall(out, b.next) &&
                 marshall(out, b.num) && marshall(out, b.reject) &&
@@ -245,6 +350,28 @@ public:
     int32_t m_bheadC; // first block of Closed; 0 if no Closed
     int32_t m_bheadO; // first block of Open;   0 if no Open
     std::array<int, 257> m_reject;
+    // Keeps the mapped image alive while vectors above borrow from it. Copy of
+    // naivevector always owns the memory, so the mapping is never copied.
+    struct Mapping {
+        Mapping() = default;
+        Mapping(const Mapping & /*other*/) {}
+        ~Mapping() = default;
+        Mapping &operator=(const Mapping & /*other*/) {
+            image.reset();
+            return *this;
+        }
+
+        std::shared_ptr<const void> image;
+    } m_mapping;
+    // Best value of each subtree, indexed by node. Only built on request and
+    // dropped on modification.
+    std::vector<int32_t> m_best;
+    // Whether some leaves refer to a shared tail string.
+    bool m_sharedTail = false;
+    // Raw value of each code stored in tail. If it is empty, tail stores the
+    // raw value.
+    std::vector<int32_t> m_codebook;
+    typename base_type::TopKOrder m_bestOrder = base_type::TopKOrder::Largest;
 
     static_assert(sizeof(node) == 8);
     static_assert(offsetof(block, prev) == 0);
@@ -264,6 +391,13 @@ public:
     size_t capacity() const { return m_array.size(); }
 
     void clear() {
+        if (m_mapping.image) {
+            m_array = {};
+            m_tail = {};
+            m_block = {};
+            m_ninfo = {};
+            m_mapping.image.reset();
+        }
         init();
         m_array.shrink_to_fit();
         m_block.shrink_to_fit();
@@ -272,6 +406,45 @@ public:
         m_tail0.shrink_to_fit();
     }
 
+    void stats(typename base_type::Stats &result) const {
+        result.keys = num_keys();
+        result.nodes = size();
+        result.tailBytes = m_tail.size();
+        size_t liveTail = sizeof(int32_t);
+        // Shared or quantized tail is always packed.
+        const bool packed = m_sharedTail || !m_codebook.empty();
+        for (int to = 0; !packed && to < static_cast<int>(size()); ++to) {
+            const node &n = m_array[to];
+            if (n.check >= 0 && m_array[n.check].base != to && n.base < 0) {
+                liveTail +=
+                    std::strlen(&m_tail[-n.base]) + 1 + sizeof(value_type);
+            }
+        }
+        result.deadTailBytes = packed ? 0 : m_tail.size() - liveTail;
+        for (const auto &b : m_block) {
+            result.emptyNodes += b.num;
+        }
+        // Count blocks in the ring, block 0 is special and never counted.
+        auto countRing = [this](int head, size_t &blocks, size_t &empty) {
+            int bi = head;
+            do {
+                if (bi) {
+                    ++blocks;
+                    empty += m_block[bi].num;
+                }
+                bi = m_block[bi].next;
+            } while (bi != head);
+        };
+        size_t fullEmpty = 0;
+        countRing(m_bheadF, result.fullBlocks, fullEmpty);
+        if (m_bheadC) {
+            countRing(m_bheadC, result.closedBlocks, result.closedEmptyNodes);
+        }
+        if (m_bheadO) {
+            countRing(m_bheadO, result.openBlocks, result.openEmptyNodes);
+        }
+    }
+
     size_t num_keys() const {
         size_t i = 0;
         for (auto to = 0; to < static_cast<int>(size()); ++to) {
@@ -355,6 +528,287 @@ public:
         }
     }
 
+    void saveImage(std::ostream &fout) {
+        if (!m_sharedTail && m_codebook.empty()) {
+            shrink_tail();
+        }
+
+        ImageHeader header;
+        header.byteOrderTag = imageByteOrderTag;
+        header.length = m_tail.size();
+        header.size = size();
+        header.bheadF = m_bheadF;
+        header.bheadC = m_bheadC;
+        header.bheadO = m_bheadO;
+
+        assert(m_block.size() << 8 == m_ninfo.size());
+        throw_if_io_fail(marshall(fout, imageMagic));
+        throw_if_io_fail(marshall(fout, image_version()));
+        size_t offset = sizeof(uint32_t) * 2;
+        auto write = [&fout, &offset](const void *data, size_t length) {
+            static constexpr char padding[imageAlignment] = {};
+            const auto aligned = alignImageOffset(offset);
+            throw_if_io_fail(fout.write(padding, aligned - offset));
+            throw_if_io_fail(
+                fout.write(static_cast<const char *>(data), length));
+            offset = aligned + length;
+        };
+        write(&header, sizeof(header));
+        write(m_array.data(), sizeof(node) * header.size);
+        write(m_ninfo.data(), sizeof(ninfo) * header.size);
+        write(m_block.data(), sizeof(block) * (header.size >> 8));
+        write(m_tail.data(), sizeof(char) * header.length);
+        if (!m_codebook.empty()) {
+            const uint32_t codebookSize = m_codebook.size();
+            write(&codebookSize, sizeof(codebookSize));
+            // The codebook is right after the size.
+            throw_if_io_fail(
+                fout.write(reinterpret_cast<const char *>(m_codebook.data()),
+                           sizeof(int32_t) * codebookSize));
+            offset += sizeof(int32_t) * codebookSize;
+        }
+        // Pad the end.
+        write(nullptr, 0);
+    }
+
+    uint32_t image_version() const {
+        if (m_codebook.empty()) {
+            return m_sharedTail ? imageSharedTailVersion : imageVersion;
+        }
+        return m_sharedTail ? imageQuantizedSharedTailVersion
+                            : imageQuantizedVersion;
+    }
+
+    static bool is_image_version(uint32_t version) {
+        return version >= imageVersion &&
+               version <= imageQuantizedSharedTailVersion;
+    }
+
+    static bool is_shared_tail_version(uint32_t version) {
+        return version == imageSharedTailVersion ||
+               version == imageQuantizedSharedTailVersion;
+    }
+
+    static bool is_quantized_version(uint32_t version) {
+        return version == imageQuantizedVersion ||
+               version == imageQuantizedSharedTailVersion;
+    }
+
+    // Return the size of the image.
+    size_t openImage(std::istream &fin) {
+        uint32_t magic = 0;
+        uint32_t version = 0;
+        throw_if_io_fail(unmarshall(fin, magic));
+        if (magic != imageMagic) {
+            throw std::invalid_argument("Invalid trie image magic.");
+        }
+        throw_if_io_fail(unmarshall(fin, version));
+        if (!is_image_version(version)) {
+            throw std::invalid_argument("Invalid trie image version.");
+        }
+        size_t offset = sizeof(uint32_t) * 2;
+        auto read = [&fin, &offset](void *data, size_t length) {
+            const auto aligned = alignImageOffset(offset);
+            throw_if_io_fail(fin.ignore(aligned - offset));
+            throw_if_io_fail(fin.read(static_cast<char *>(data), length));
+            offset = aligned + length;
+        };
+
+        ImageHeader header;
+        read(&header, sizeof(header));
+        const bool swapped = !header.isNative();
+        if (swapped) {
+            if (!header.isSwapped()) {
+                throw std::invalid_argument("Invalid trie image byte order.");
+            }
+            header.swap();
+        }
+
+        m_tail.resize(header.length);
+        m_tail0.resize(0);
+        m_array.resize(header.size);
+        m_ninfo.resize(header.size);
+        m_block.resize(header.size >> 8);
+        m_bheadF = header.bheadF;
+        m_bheadC = header.bheadC;
+        m_bheadO = header.bheadO;
+
+        read(m_array.data(), sizeof(node) * m_array.size());
+        read(m_ninfo.data(), sizeof(ninfo) * m_ninfo.size());
+        read(m_block.data(), sizeof(block) * m_block.size());
+        read(m_tail.data(), sizeof(char) * m_tail.size());
+        m_sharedTail = is_shared_tail_version(version);
+        m_codebook.clear();
+        if (is_quantized_version(version)) {
+            uint32_t codebookSize = 0;
+            read(&codebookSize, sizeof(codebookSize));
+            if (swapped) {
+                swapByteOrder(codebookSize);
+            }
+            if (codebookSize == 0 || codebookSize > (1U << 16)) {
+                throw std::invalid_argument("Invalid trie image codebook.");
+            }
+            m_codebook.resize(codebookSize);
+            // The codebook is right after the size.
+            throw_if_io_fail(
+                fin.read(reinterpret_cast<char *>(m_codebook.data()),
+                         sizeof(int32_t) * codebookSize));
+            offset += sizeof(int32_t) * codebookSize;
+            if (swapped) {
+                for (auto &value : m_codebook) {
+                    swapByteOrder(value);
+                }
+            }
+        }
+        // Skip the padding at the end.
+        read(nullptr, 0);
+        if (swapped) {
+            for (auto &node : m_array) {
+                node.swap();
+            }
+            // ninfo and tail are not endian issue.
+            for (auto &block : m_block) {
+                block.swap();
+            }
+        }
+        return offset;
+    }
+
+    // Map the image at offset of file, return the offset after the image.
+    size_t mapImage(const char *filename, size_t offset) {
+        if (offset % imageAlignment) {
+            throw std::invalid_argument("Invalid trie image offset.");
+        }
+#ifdef LIBIME_DATRIE_HAS_MMAP
+        const int fd = ::open(filename, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            throw std::ios_base::failure("io fail");
+        }
+        struct stat st;
+        void *addr = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            addr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        }
+        ::close(fd);
+        if (addr == MAP_FAILED) {
+            throw std::ios_base::failure("io fail");
+        }
+        const size_t mappedSize = st.st_size;
+        std::shared_ptr<const void> mapping(
+            addr, [mappedSize](const void *data) {
+                munmap(const_cast<void *>(data), mappedSize);
+            });
+        if (mappedSize < offset) {
+            throw std::invalid_argument("Invalid trie image.");
+        }
+        // Offsets below are relative to the image.
+        const char *data = static_cast<const char *>(addr) + offset;
+        const size_t fileSize = mappedSize - offset;
+
+        ImageHeader header;
+        const size_t headerOffset = alignImageOffset(sizeof(uint32_t) * 2);
+        if (fileSize < headerOffset + sizeof(header) ||
+            be32toh(loadNative<uint32_t>(data)) != imageMagic) {
+            throw std::invalid_argument("Invalid trie image.");
+        }
+        const auto version =
+            be32toh(loadNative<uint32_t>(data + sizeof(uint32_t)));
+        if (!is_image_version(version)) {
+            throw std::invalid_argument("Invalid trie image.");
+        }
+        std::memcpy(&header, data + headerOffset, sizeof(header));
+        if (!header.isNative()) {
+            // Fallback to copy, which also converts the byte order.
+            mapping.reset();
+            return readImage(filename, offset);
+        }
+
+        const size_t arrayOffset =
+            alignImageOffset(headerOffset + sizeof(header));
+        const size_t ninfoOffset =
+            alignImageOffset(arrayOffset + sizeof(node) * header.size);
+        const size_t blockOffset =
+            alignImageOffset(ninfoOffset + sizeof(ninfo) * header.size);
+        const size_t tailOffset = alignImageOffset(
+            blockOffset + sizeof(block) * (header.size >> 8));
+        if (fileSize < tailOffset + header.length) {
+            throw std::invalid_argument("Invalid trie image.");
+        }
+        size_t imageSize = tailOffset + header.length;
+        std::vector<int32_t> codebook;
+        if (is_quantized_version(version)) {
+            const size_t codebookOffset =
+                alignImageOffset(tailOffset + header.length);
+            uint32_t codebookSize = 0;
+            if (fileSize >= codebookOffset + sizeof(codebookSize)) {
+                codebookSize = loadNative<uint32_t>(data + codebookOffset);
+            }
+            if (codebookSize == 0 || codebookSize > (1U << 16) ||
+                fileSize < codebookOffset + sizeof(codebookSize) +
+                               (sizeof(int32_t) * codebookSize)) {
+                throw std::invalid_argument("Invalid trie image.");
+            }
+            // Codebook is small, so just copy it.
+            codebook.resize(codebookSize);
+            std::memcpy(codebook.data(),
+                        data + codebookOffset + sizeof(codebookSize),
+                        sizeof(int32_t) * codebookSize);
+            imageSize = codebookOffset + sizeof(codebookSize) +
+                        (sizeof(int32_t) * codebookSize);
+        }
+
+        m_array = vector_impl<node>::borrow(
+            reinterpret_cast<const node *>(data + arrayOffset),
+            header.size);
+        m_ninfo = vector_impl<ninfo>::borrow(
+            reinterpret_cast<const ninfo *>(data + ninfoOffset),
+            header.size);
+        m_block = vector_impl<block>::borrow(
+            reinterpret_cast<const block *>(data + blockOffset),
+            header.size >> 8);
+        m_tail = vector_impl<char>::borrow(data + tailOffset, header.length);
+        m_sharedTail = is_shared_tail_version(version);
+        m_codebook = std::move(codebook);
+        m_tail0.resize(0);
+        m_bheadF = header.bheadF;
+        m_bheadC = header.bheadC;
+        m_bheadO = header.bheadO;
+        m_mapping.image = std::move(mapping);
+        return offset + alignImageOffset(imageSize);
+#else
+        return readImage(filename, offset);
+#endif
+    }
+
+    // Read the image at offset of file, return the offset after the image.
+    size_t readImage(const char *filename, size_t offset) {
+        std::ifstream fin(filename, std::ios::in | std::ios::binary);
+        throw_if_io_fail(fin);
+        throw_if_io_fail(fin.seekg(static_cast<std::streamoff>(offset)));
+        return offset + openImage(fin);
+    }
+
+    // Copy the borrowed data into owned memory, unshare and unquantize the
+    // tail before any modification.
+    void detach() {
+        own();
+        if (m_sharedTail || !m_codebook.empty()) {
+            _shrink_tail();
+        }
+    }
+
+    // Copy the borrowed data into owned memory.
+    void own() {
+        if (m_mapping.image) {
+            // Copy of naivevector always owns the memory.
+            m_array = decltype(m_array)(m_array);
+            m_tail = decltype(m_tail)(m_tail);
+            m_block = decltype(m_block)(m_block);
+            m_ninfo = decltype(m_ninfo)(m_ninfo);
+            m_mapping.image.reset();
+        }
+    }
+
     void init() {
         m_bheadF = m_bheadC = m_bheadO = 0;
         m_array.clear();
@@ -381,6 +835,10 @@ public:
         for (auto i = 0; i <= 256; ++i) {
             m_reject[i] = i + 1;
         }
+        m_best.clear();
+        m_best.shrink_to_fit();
+        m_sharedTail = false;
+        m_codebook.clear();
     }
 
     void suffix(std::string &key, size_t len, npos_t pos) const {
@@ -389,7 +847,7 @@ public:
 
         auto to = pos.index;
         if (const int offset = pos.offset) {
-            size_t len_tail = std::strlen(&m_tail[-m_array[to].base]);
+            size_t len_tail = std::strlen(&m_tail[_tail_start(to)]);
             if (len > len_tail) {
                 len -= len_tail;
             } else {
@@ -431,6 +889,8 @@ public:
         if (!len && !npos) {
             throw std::invalid_argument("failed to insert zero-length key");
         }
+        detach();
+        m_best.clear();
 
         auto &from = npos.index;
         auto offset = npos.offset;
@@ -546,6 +1006,93 @@ public:
         storeDWord(data, callback(loadDWord<value_type>(data)));
     }
 
+    void build(std::span<const std::pair<std::string_view, value_type>> input) {
+        std::vector<std::pair<std::string_view, value_type>> entries;
+        entries.reserve(input.size());
+        for (const auto &entry : input) {
+            if (entry.first.empty()) {
+                throw std::invalid_argument("failed to insert zero-length key");
+            }
+            if (!entries.empty()) {
+                if (entry.first < entries.back().first) {
+                    throw std::invalid_argument("keys are not sorted");
+                }
+                if (entry.first == entries.back().first) {
+                    entries.back().second = entry.second;
+                    continue;
+                }
+            }
+            entries.push_back(entry);
+        }
+        if (entries.empty()) {
+            return;
+        }
+        m_tail.reserve(m_tail.size() + entries.size() * (2 + sizeof(int32_t)));
+        _build(entries.begin(), entries.end(), 0, 0);
+    }
+
+    // Place all children of from at once, so no relocation is needed.
+    template <typename Iter>
+    void _build(Iter first, Iter last, size_t depth, uint32_t from) {
+        if (from && std::next(first) == last) {
+            // Only one key left, put the remaining part in tail.
+            const auto rest = first->first.substr(depth);
+            const auto offset = m_tail.size();
+            m_tail.resize(offset + rest.size() + 1 + sizeof(value_type));
+            std::copy(rest.begin(), rest.end(), &m_tail[offset]);
+            m_tail[offset + rest.size()] = '\0';
+            storeDWord(&m_tail[offset + rest.size() + 1], first->second);
+            m_array[from].base = -static_cast<int32_t>(offset);
+            return;
+        }
+
+        uchar child[256];
+        uchar *const begin = child;
+        uchar *end = child;
+        for (auto iter = first; iter != last; ++iter) {
+            // Shorter key is always the first, use 0 as terminal.
+            const uchar label = depth < iter->first.size()
+                                    ? static_cast<uchar>(iter->first[depth])
+                                    : 0;
+            if (end == begin || *(end - 1) != label) {
+                *end = label;
+                ++end;
+            }
+        }
+
+        int base = m_array[from].base;
+        if (from) {
+            base = (begin + 1 == end ? _find_place()
+                                     : _find_place_dense(begin, end)) ^
+                   *begin;
+            m_array[from].base = base;
+            m_ninfo[from].child = *begin;
+        } else {
+            // Root is its own terminal child, the labels start from sibling.
+            m_ninfo[from].sibling = *begin;
+        }
+        for (const uchar *p = begin; p < end; ++p) {
+            const int to = _pop_enode(base, *p, static_cast<int>(from));
+            m_ninfo[to].sibling = (p + 1 == end) ? 0 : *(p + 1);
+        }
+
+        for (auto iter = first; iter != last;) {
+            if (depth == iter->first.size()) {
+                m_array[base ^ 0].value = iter->second;
+                ++iter;
+                continue;
+            }
+            const auto label = static_cast<uchar>(iter->first[depth]);
+            auto next = std::next(iter);
+            while (next != last &&
+                   static_cast<uchar>(next->first[depth]) == label) {
+                ++next;
+            }
+            _build(iter, next, depth + 1, base ^ label);
+            iter = next;
+        }
+    }
+
     // easy-going erase () without compression
     int erase(const char *key) { return erase(key, std::strlen(key)); }
     int erase(const char *key, size_t len, npos_t npos = npos_t()) {
@@ -555,6 +1102,8 @@ public:
         if (i == CEDAR_NO_PATH || i == CEDAR_NO_VALUE) {
             return -1;
         }
+        detach();
+        m_best.clear();
         if (npos.offset) {
             npos.offset = 0; // leave tail as is
         }
@@ -601,7 +1150,180 @@ public:
             return true;
         });
     }
+    bool better(int32_t lhs, int32_t rhs) const {
+        if (rhs == CEDAR_NO_VALUE) {
+            return lhs != CEDAR_NO_VALUE;
+        }
+        if (lhs == CEDAR_NO_VALUE) {
+            return false;
+        }
+        const auto lhsValue = decodeImpl<V>(lhs);
+        const auto rhsValue = decodeImpl<V>(rhs);
+        return m_bestOrder == base_type::TopKOrder::Largest
+                   ? lhsValue > rhsValue
+                   : lhsValue < rhsValue;
+    }
+
+    // return the first label of children, label 0 is the terminal.
+    uchar _first_label(uint32_t from) const {
+        uchar c = m_ninfo[from].child;
+        if (!from) {
+            // Root is its own terminal child, skip it.
+            c = m_ninfo[m_array[from].base ^ c].sibling;
+        }
+        return c;
+    }
+
+    void build_best(typename base_type::TopKOrder order) {
+        m_bestOrder = order;
+        m_best.assign(m_array.size(), CEDAR_NO_VALUE);
+        _build_best(0);
+    }
+
+    int32_t _build_best(uint32_t from) {
+        const int base = m_array[from].base;
+        if (base < 0) {
+            const auto start = _tail_start(from);
+            m_best[from] =
+                _tail_value(from, start + std::strlen(&m_tail[start]));
+            return m_best[from];
+        }
+        int32_t best = CEDAR_NO_VALUE;
+        uchar c = _first_label(from);
+        if (!from && !c) {
+            return best;
+        }
+        while (true) {
+            const auto to = static_cast<uint32_t>(base ^ c);
+            const int32_t value = c ? _build_best(to) : m_array[to].base;
+            if (better(value, best)) {
+                best = value;
+            }
+            c = m_ninfo[to].sibling;
+            if (!c) {
+                break;
+            }
+        }
+        m_best[from] = best;
+        return best;
+    }
+
+    // retrieve the full key of pos from root.
+    void _key(std::string &key, npos_t pos) const {
+        key.clear();
+        for (auto to = pos.index; to != 0;) {
+            const auto from = static_cast<uint32_t>(m_array[to].check);
+            key.push_back(static_cast<char>(m_array[from].base ^ to));
+            to = from;
+        }
+        std::reverse(key.begin(), key.end());
+        if (pos.offset) {
+            const auto start = _tail_start(pos.index);
+            key.append(&m_tail[start], pos.offset - start);
+        }
+    }
+
+    // Position and value of the key in the tail of a leaf node.
+    std::pair<npos_t, int32_t> _tail_leaf(npos_t pos) const {
+        const size_t start = pos.offset ? pos.offset : _tail_start(pos.index);
+        pos.offset = start + std::strlen(&m_tail[start]);
+        return {pos, _tail_value(pos.index, pos.offset)};
+    }
+
+    std::vector<std::pair<std::string, value_type>> topK(npos_t root,
+                                                         size_t k) const {
+        std::vector<std::pair<std::string, value_type>> result;
+        // Value and position of keys, with a flag for unexpanded node.
+        struct Candidate {
+            int32_t value;
+            npos_t pos;
+            bool node;
+        };
+        std::vector<Candidate> candidates;
+        auto worse = [this](const Candidate &lhs, const Candidate &rhs) {
+            if (lhs.value != rhs.value) {
+                return better(rhs.value, lhs.value);
+            }
+            // Prefer finished keys on tie.
+            return lhs.node && !rhs.node;
+        };
+        auto push = [&candidates, &worse](int32_t value, npos_t pos,
+                                          bool node) {
+            if (value == CEDAR_NO_VALUE) {
+                return;
+            }
+            candidates.push_back({value, pos, node});
+            std::push_heap(candidates.begin(), candidates.end(), worse);
+        };
+
+        if (m_best.empty()) {
+            // No index, enumerate everything under root.
+            foreach(
+                [&candidates](value_type value, size_t, position_type pos) {
+                    decoder_type decoder;
+                    decoder.result_value = value;
+                    candidates.push_back({decoder.result, npos_t(pos), false});
+                    return true;
+                },
+                root);
+            std::make_heap(candidates.begin(), candidates.end(), worse);
+        } else if (root.offset || m_array[root.index].base < 0) {
+            const auto [pos, value] = _tail_leaf(root);
+            push(value, pos, false);
+        } else {
+            push(m_best[root.index], root, true);
+        }
+
+        std::string key;
+        while (!candidates.empty() && (!k || result.size() < k)) {
+            std::pop_heap(candidates.begin(), candidates.end(), worse);
+            const auto candidate = candidates.back();
+            candidates.pop_back();
+            if (!candidate.node) {
+                _key(key, candidate.pos);
+                result.emplace_back(key, decodeImpl<V>(candidate.value));
+                continue;
+            }
+            const auto from = candidate.pos.index;
+            const int base = m_array[from].base;
+            uchar c = _first_label(from);
+            if (!from && !c) {
+                continue;
+            }
+            while (true) {
+                const auto to = static_cast<uint32_t>(base ^ c);
+                if (!c) {
+                    push(m_array[to].base, candidate.pos, false);
+                } else if (m_array[to].base < 0) {
+                    npos_t pos;
+                    pos.index = to;
+                    const auto [leaf, value] = _tail_leaf(pos);
+                    push(value, leaf, false);
+                } else {
+                    npos_t pos;
+                    pos.index = to;
+                    push(m_best[to], pos, true);
+                }
+                c = m_ninfo[to].sibling;
+                if (!c) {
+                    break;
+                }
+            }
+        }
+        return result;
+    }
+
     void shrink_tail() {
+        const bool packed = m_sharedTail || !m_codebook.empty();
+        detach();
+        if (!packed) {
+            _shrink_tail();
+        }
+    }
+
+    // Copy all the tails to a new packed one, which also unshares and
+    // unquantizes the tail.
+    void _shrink_tail() {
         const size_t length_ =
             static_cast<size_t>(m_tail.size()) -
             (static_cast<size_t>(m_tail0.size()) * (1 + sizeof(value_type)));
@@ -612,21 +1334,291 @@ public:
         for (int to = 0; to < static_cast<int>(size()); ++to) {
             node &n = m_array[to];
             if (n.check >= 0 && m_array[n.check].base != to && n.base < 0) {
-                char *const tail_(&m_tail[-n.base]);
+                const auto start = _tail_start(to);
+                const char *const tail_(&m_tail[start]);
+                const auto value = _tail_value(to, start + std::strlen(tail_));
                 n.base = -static_cast<int32_t>(t.size());
                 auto i = 0;
                 do {
                     t.push_back(tail_[i]);
                 } while (tail_[i++]);
                 t.resize(t.size() + sizeof(value_type));
-                storeDWord(&t[t.size() - sizeof(value_type)],
-                           loadDWord<value_type>(&tail_[i]));
+                storeDWord(&t[t.size() - sizeof(value_type)], value);
             }
         }
         using std::swap;
         swap(t, m_tail);
         m_tail0.resize(0);
         m_tail0.shrink_to_fit();
+        m_sharedTail = false;
+        m_codebook.clear();
+    }
+
+    // Size of the value stored in tail, which is the size of code if
+    // quantized.
+    size_t _value_size() const {
+        if (m_codebook.empty()) {
+            return sizeof(int32_t);
+        }
+        return m_codebook.size() <= (1U << 8) ? 1 : 2;
+    }
+
+    uint32_t _load_code(const char *data) const {
+        const auto *bytes = reinterpret_cast<const uint8_t *>(data);
+        switch (_value_size()) {
+        case 1:
+            return bytes[0];
+        case 2:
+            return bytes[0] | (static_cast<uint32_t>(bytes[1]) << 8);
+        default:
+            return loadDWord<uint32_t>(data);
+        }
+    }
+
+    void _store_code(char *data, uint32_t code) const {
+        switch (_value_size()) {
+        case 1:
+            data[0] = static_cast<char>(code);
+            break;
+        case 2:
+            data[0] = static_cast<char>(code);
+            data[1] = static_cast<char>(code >> 8);
+            break;
+        default:
+            storeDWord(data, code);
+            break;
+        }
+    }
+
+    // Offset of the tail string of a leaf.
+    size_t _tail_start(uint32_t index) const {
+        const auto ref = static_cast<uint32_t>(-m_array[index].base);
+        if (ref & sharedTailFlag) {
+            return loadDWord<uint32_t>(
+                &m_tail[(ref & ~sharedTailFlag) + _value_size()]);
+        }
+        return ref;
+    }
+
+    // Code of a leaf, which is the raw value if not quantized, end is the
+    // offset of the end of its tail string.
+    uint32_t _tail_code(uint32_t index, size_t end) const {
+        const auto ref = static_cast<uint32_t>(-m_array[index].base);
+        if (ref & sharedTailFlag) {
+            return _load_code(&m_tail[ref & ~sharedTailFlag]);
+        }
+        return _load_code(&m_tail[end + 1]);
+    }
+
+    // Value of a leaf, end is the offset of the end of its tail string.
+    int32_t _tail_value(uint32_t index, size_t end) const {
+        const auto code = _tail_code(index, end);
+        if (m_codebook.empty()) {
+            return static_cast<int32_t>(code);
+        }
+        return m_codebook[code];
+    }
+
+    // Store the tail string only once if it is also the suffix of other tail.
+    // Leaf with such tail uses a record of value and string offset instead,
+    // if the record is shorter than the tail.
+    void share_tail() {
+        if (m_sharedTail) {
+            return;
+        }
+        if (m_codebook.empty()) {
+            shrink_tail();
+        } else {
+            // Quantized tail is already packed.
+            own();
+        }
+        struct Leaf {
+            uint32_t index;
+            std::string_view tail;
+            uint32_t code;
+        };
+        std::vector<Leaf> leaves;
+        for (int to = 0; to < static_cast<int>(size()); ++to) {
+            const node &n = m_array[to];
+            if (n.check >= 0 && m_array[n.check].base != to && n.base < 0) {
+                const std::string_view tail(&m_tail[-n.base]);
+                leaves.push_back({static_cast<uint32_t>(to), tail,
+                                  _tail_code(to, -n.base + tail.size())});
+            }
+        }
+        // Sort by reversed tail, so a tail is the suffix of the next one if
+        // it is the suffix of any other tail.
+        std::ranges::sort(leaves, [](const Leaf &lhs, const Leaf &rhs) {
+            return std::lexicographical_compare(lhs.tail.rbegin(),
+                                                lhs.tail.rend(),
+                                                rhs.tail.rbegin(),
+                                                rhs.tail.rend());
+        });
+        const size_t valueSize = _value_size();
+        const size_t recordSize = valueSize + sizeof(uint32_t);
+        std::vector<uint32_t> host(leaves.size());
+        for (size_t i = leaves.size(); i-- > 0;) {
+            host[i] = i;
+            if (i + 1 < leaves.size() &&
+                leaves[i].tail.size() + 1 + valueSize > recordSize &&
+                leaves[i + 1].tail.ends_with(leaves[i].tail)) {
+                host[i] = host[i + 1];
+            }
+        }
+
+        decltype(m_tail) t;
+        t.resize(sizeof(int32_t));
+        t.reserve(m_tail.size());
+        std::vector<uint32_t> starts(leaves.size());
+        for (size_t i = 0; i < leaves.size(); ++i) {
+            if (host[i] != i) {
+                continue;
+            }
+            const auto &leaf = leaves[i];
+            starts[i] = t.size();
+            t.resize(t.size() + leaf.tail.size() + 1 + valueSize);
+            std::copy(leaf.tail.begin(), leaf.tail.end(), &t[starts[i]]);
+            t[starts[i] + leaf.tail.size()] = '\0';
+            _store_code(&t[starts[i] + leaf.tail.size() + 1], leaf.code);
+        }
+        for (size_t i = 0; i < leaves.size(); ++i) {
+            if (host[i] == i) {
+                continue;
+            }
+            const auto &leaf = leaves[i];
+            const auto &hostLeaf = leaves[host[i]];
+            const auto offset = t.size();
+            t.resize(t.size() + recordSize);
+            _store_code(&t[offset], leaf.code);
+            storeDWord(&t[offset + valueSize],
+                       static_cast<uint32_t>(starts[host[i]] +
+                                             hostLeaf.tail.size() -
+                                             leaf.tail.size()));
+            starts[i] = offset | sharedTailFlag;
+        }
+        if (t.size() >= m_tail.size() || t.size() >= sharedTailFlag) {
+            return;
+        }
+        for (size_t i = 0; i < leaves.size(); ++i) {
+            m_array[leaves[i].index].base = -static_cast<int32_t>(starts[i]);
+        }
+        using std::swap;
+        swap(t, m_tail);
+        m_sharedTail = true;
+    }
+
+    // Replace the values with at most 2^bits levels, and store the index of
+    // the level in tail instead of the value. Levels split the sorted values
+    // into groups of the same size, so the more common values get the finer
+    // levels. Values in nodes are replaced with the level as well, so every
+    // key reads the same quantized value.
+    void quantize(unsigned int bits) {
+        if (bits != 8 && bits != 16) {
+            throw std::invalid_argument("Only 8 or 16 bits are supported.");
+        }
+        const bool shared = m_sharedTail;
+        shrink_tail();
+
+        std::vector<value_type> values;
+        bool hasNoValue = false;
+        auto collect = [this, &values, &hasNoValue](int32_t raw) {
+            if (raw == CEDAR_NO_VALUE) {
+                hasNoValue = true;
+            } else {
+                values.push_back(std::bit_cast<value_type>(raw));
+            }
+        };
+        for (int to = 0; to < static_cast<int>(size()); ++to) {
+            const node &n = m_array[to];
+            if (n.check < 0) {
+                continue;
+            }
+            if (m_array[n.check].base == to) {
+                collect(n.base);
+            } else if (n.base < 0) {
+                collect(_tail_value(to, -n.base + std::strlen(
+                                                     &m_tail[-n.base])));
+            }
+        }
+        if (values.empty() && !hasNoValue) {
+            return;
+        }
+
+        std::ranges::sort(values);
+        const size_t maxLevels = (size_t(1) << bits) - (hasNoValue ? 1 : 0);
+        std::vector<value_type> levels;
+        std::ranges::unique_copy(values, std::back_inserter(levels));
+        if (levels.size() > maxLevels) {
+            levels.clear();
+            for (size_t i = 0; i < maxLevels; ++i) {
+                const auto first = values.size() * i / maxLevels;
+                const auto last = values.size() * (i + 1) / maxLevels;
+                if (first != last) {
+                    levels.push_back(values[(first + last) / 2]);
+                }
+            }
+            levels.erase(std::ranges::unique(levels).begin(), levels.end());
+        }
+        values = {};
+
+        std::vector<int32_t> codebook;
+        codebook.reserve(levels.size() + 1);
+        for (const auto &level : levels) {
+            codebook.push_back(std::bit_cast<int32_t>(level));
+        }
+        if (hasNoValue) {
+            codebook.push_back(CEDAR_NO_VALUE);
+        }
+        auto encode = [&levels, hasNoValue](int32_t raw) -> uint32_t {
+            if (raw == CEDAR_NO_VALUE) {
+                return levels.size();
+            }
+            const auto value = std::bit_cast<value_type>(raw);
+            auto iter = std::ranges::lower_bound(levels, value);
+            if (iter == levels.end() ||
+                (iter != levels.begin() &&
+                 static_cast<double>(value) - static_cast<double>(*(iter - 1)) <
+                     static_cast<double>(*iter) - static_cast<double>(value))) {
+                --iter;
+            }
+            return iter - levels.begin();
+        };
+
+        std::vector<std::pair<uint32_t, uint32_t>> leaves;
+        for (int to = 0; to < static_cast<int>(size()); ++to) {
+            node &n = m_array[to];
+            if (n.check < 0) {
+                continue;
+            }
+            if (m_array[n.check].base == to) {
+                n.base = codebook[encode(n.base)];
+            } else if (n.base < 0) {
+                leaves.emplace_back(
+                    to, encode(_tail_value(
+                            to, -n.base + std::strlen(&m_tail[-n.base]))));
+            }
+        }
+
+        m_codebook = std::move(codebook);
+        const size_t valueSize = _value_size();
+        decltype(m_tail) t;
+        // a dummy entry
+        t.resize(sizeof(int32_t));
+        t.reserve(m_tail.size());
+        for (const auto &[to, code] : leaves) {
+            node &n = m_array[to];
+            const std::string_view tail(&m_tail[-n.base]);
+            n.base = -static_cast<int32_t>(t.size());
+            t.resize(t.size() + tail.size() + 1 + valueSize);
+            std::ranges::copy(tail, &t[-n.base]);
+            t[-n.base + tail.size()] = '\0';
+            _store_code(&t[-n.base + tail.size() + 1], code);
+        }
+        using std::swap;
+        swap(t, m_tail);
+        if (shared) {
+            share_tail();
+        }
     }
 
     // return the first child for a tree rooted by a given node
@@ -651,10 +1643,11 @@ public:
                 return m_array[base ^ c].base;
             }
         }
-        const size_t len_ = std::strlen(&m_tail[-base]);
-        npos.offset = static_cast<size_t>(-base) + len_;
+        const size_t start = npos.offset ? npos.offset : _tail_start(from);
+        const size_t len_ = std::strlen(&m_tail[start]);
+        npos.offset = start + len_;
         len += len_;
-        return loadDWord<int32_t>(&m_tail[-base] + len_ + 1);
+        return _tail_value(from, npos.offset);
     }
     // return the next child if any
     int32_t next(npos_t &npos, size_t &len,
@@ -666,7 +1659,7 @@ public:
                 return CEDAR_NO_PATH;
             }
             npos.offset = 0;
-            len -= static_cast<size_t>(offset - (-m_array[from].base));
+            len -= static_cast<size_t>(offset - _tail_start(from));
         } else {
             c = m_ninfo[m_array[from].base].sibling;
         }
@@ -719,7 +1712,7 @@ public:
                 ++pos;
                 from = to;
             }
-            offset = -m_array[from].base;
+            offset = _tail_start(from);
         }
         // switch to _tail to match suffix
         const size_t pos_orig = pos; // start position in reading _tail
@@ -740,7 +1733,76 @@ public:
         if (tail[pos]) {
             return CEDAR_NO_VALUE; // input < tail
         }
-        return loadDWord<int32_t>(&tail[len + 1]);
+        return _tail_value(from, &tail[len] - m_tail.data());
+    }
+
+    // Same as calling _find for each key with pos = 0, but the lookups are
+    // interleaved, so the cache miss of one lookup overlaps with others. n
+    // must not be larger than MAX_BATCH_LOOKUP.
+    void find_batch(const std::string_view *keys, npos_t *npos,
+                    int32_t *results, size_t n) const {
+        struct Lookup {
+            size_t index;
+            size_t pos;
+            // Node to move to, which is prefetched in last round.
+            int32_t to;
+            // Only the value left, which is prefetched in last round.
+            bool last;
+        };
+        assert(n <= MAX_BATCH_LOOKUP);
+        std::array<Lookup, MAX_BATCH_LOOKUP> lookups;
+        size_t count = 0;
+        for (size_t i = 0; i < n; ++i) {
+            lookups[count++] = {i, 0, -1, false};
+            prefetch(&m_array[npos[i].index]);
+        }
+        while (count) {
+            for (size_t i = 0; i < count;) {
+                auto &lookup = lookups[i];
+                if (_find_step(keys[lookup.index], npos[lookup.index],
+                               results[lookup.index], lookup)) {
+                    lookup = lookups[--count];
+                } else {
+                    ++i;
+                }
+            }
+        }
+    }
+
+    // Move lookup by one node and prefetch the next one, return true if
+    // lookup is done.
+    template <typename Lookup>
+    bool _find_step(std::string_view key, npos_t &npos, int32_t &result,
+                    Lookup &lookup) const {
+        auto &from = npos.index;
+        if (lookup.last) {
+            result = _find(key.data(), npos, lookup.pos, key.size());
+            return true;
+        }
+        if (lookup.to >= 0) {
+            if (m_array[lookup.to].check != static_cast<int>(from)) {
+                result = CEDAR_NO_PATH;
+                return true;
+            }
+            from = lookup.to;
+            ++lookup.pos;
+            lookup.to = -1;
+        }
+        const int32_t base = m_array[from].base;
+        if (npos.offset) {
+            prefetch(&m_tail[npos.offset]);
+            lookup.last = true;
+        } else if (base < 0) {
+            prefetch(&m_tail[static_cast<uint32_t>(-base) & ~sharedTailFlag]);
+            lookup.last = true;
+        } else if (lookup.pos == key.size()) {
+            prefetch(&m_array[base]);
+            lookup.last = true;
+        } else {
+            lookup.to = base ^ static_cast<uchar>(key[lookup.pos]);
+            prefetch(&m_array[lookup.to]);
+        }
+        return false;
     }
 
     // explore new block to settle down
@@ -792,6 +1854,49 @@ public:
         return _add_block() << 8;
     }
 
+    // Like _find_place, but also look for a place in Closed blocks first.
+    // Without relocation, build would otherwise leave most of the Closed
+    // blocks empty.
+    int _find_place_dense(const uchar *const first, const uchar *const last) {
+        if (auto bi = m_bheadC) {
+            const auto nc = std::distance(first, last);
+            for (int i = 0; i < MAX_DENSE_TRIAL; ++i) {
+                block &b = m_block[bi];
+                if (b.num >= nc && nc < b.reject) {
+                    if (const int e = _explore_block(b, first, last)) {
+                        return e;
+                    }
+                    b.reject = nc;
+                    if (b.reject < m_reject[b.num]) {
+                        m_reject[b.num] = b.reject;
+                    }
+                }
+                // Continue from the next one for next time.
+                bi = m_bheadC = b.next;
+            }
+        }
+        return _find_place(first, last);
+    }
+
+    // Return the first empty node in block that all labels can be placed
+    // relative to, or 0 if there is none.
+    int _explore_block(const block &b, const uchar *const first,
+                       const uchar *const last) const {
+        for (int e = b.ehead;;) {
+            const int base = e ^ *first;
+            for (const uchar *p = first; m_array[base ^ *++p].check < 0;) {
+                if (p + 1 == last) {
+                    return e;
+                }
+            }
+            e = -m_array[e].check;
+            if (e == b.ehead) {
+                break;
+            }
+        }
+        return 0;
+    }
+
     static void _set_result(result_type *x, value_type r, size_t /*len*/ = 0,
                             npos_t /*npos*/ = npos_t()) {
         *x = r;
@@ -1093,11 +2198,145 @@ void DATrie<T>::save(std::ostream &stream) {
     d->save(stream);
 }
 
+template <typename T>
+void DATrie<T>::loadImage(const char *filename) {
+    loadImage(filename, 0);
+}
+
+template <typename T>
+size_t DATrie<T>::loadImage(const char *filename, size_t offset) {
+    clear();
+    return d->mapImage(filename, offset);
+}
+
+template <typename T>
+void DATrie<T>::loadImage(std::istream &in) {
+    clear();
+    d->openImage(in);
+}
+
+template <typename T>
+void DATrie<T>::saveImage(const char *filename) {
+    std::ofstream fout(filename, std::ios::out | std::ios::binary);
+    throw_if_io_fail(fout);
+    saveImage(fout);
+}
+
+template <typename T>
+void DATrie<T>::saveImage(std::ostream &stream) {
+    d->saveImage(stream);
+}
+
+template <typename T>
+typename DATrie<T>::RawView DATrie<T>::rawView() const {
+    using node = typename DATriePrivate<T>::node;
+    using ninfo = typename DATriePrivate<T>::ninfo;
+    static_assert(offsetof(node, base) == 0 && offsetof(node, check) == 4);
+    static_assert(offsetof(ninfo, sibling) == 0 && offsetof(ninfo, child) == 1);
+    static_assert(RawView::sharedTailFlag == sharedTailFlag);
+    return {reinterpret_cast<const int32_t *>(d->m_array.data()),
+            reinterpret_cast<const uint8_t *>(d->m_ninfo.data()),
+            d->m_tail.data(), DATriePrivate<T>::CEDAR_NO_VALUE,
+            d->m_codebook.empty() ? nullptr : d->m_codebook.data(),
+            static_cast<uint32_t>(d->_value_size())};
+}
+
+template <typename T>
+bool DATrie<T>::isMapped() const {
+    return d->m_mapping.image != nullptr;
+}
+
 template <typename T>
 void DATrie<T>::set(const char *key, size_t len, value_type val) {
     d->update(key, len, [val](value_type) { return val; });
 }
 
+template <typename T>
+void DATrie<T>::build(
+    std::span<const std::pair<std::string_view, value_type>> entries) {
+    clear();
+    d->build(entries);
+}
+
+template <typename T>
+void DATrie<T>::buildTopKIndex(TopKOrder order) {
+    d->build_best(order);
+}
+
+template <typename T>
+bool DATrie<T>::hasTopKIndex() const {
+    return !d->m_best.empty();
+}
+
+template <typename T>
+std::vector<std::pair<std::string, typename DATrie<T>::value_type>>
+DATrie<T>::topK(std::string_view prefix, size_t k, position_type pos) const {
+    size_t p = 0;
+    typename DATriePrivate<value_type>::npos_t from(pos);
+    if (d->_find(prefix.data(), from, p, prefix.size()) ==
+        DATriePrivate<value_type>::CEDAR_NO_PATH) {
+        return {};
+    }
+    return d->topK(from, k);
+}
+
+template <typename T>
+void DATrie<T>::shareTail() {
+    d->share_tail();
+}
+
+template <typename T>
+bool DATrie<T>::isTailShared() const {
+    return d->m_sharedTail;
+}
+
+template <typename T>
+void DATrie<T>::quantize(unsigned int bits) {
+    d->quantize(bits);
+    if (hasTopKIndex()) {
+        d->build_best(d->m_bestOrder);
+    }
+}
+
+template <typename T>
+bool DATrie<T>::isQuantized() const {
+    return !d->m_codebook.empty();
+}
+
+template <typename T>
+typename DATrie<T>::Stats DATrie<T>::stats() const {
+    Stats result;
+    d->stats(result);
+    return result;
+}
+
+template <typename T>
+void DATrie<T>::compact() {
+    std::vector<std::pair<std::string, value_type>> entries;
+    foreachKey([&entries](value_type value, std::string_view key,
+                          position_type) {
+        entries.emplace_back(key, value);
+        return true;
+    });
+    if (!std::ranges::is_sorted(entries, std::less<>(),
+                                &std::pair<std::string, value_type>::first)) {
+        std::ranges::sort(entries, std::less<>(),
+                          &std::pair<std::string, value_type>::first);
+    }
+    std::vector<std::pair<std::string_view, value_type>> sortedEntries(
+        entries.begin(), entries.end());
+
+    // Build into a new one, so the trie is untouched if anything throws.
+    auto compacted = std::make_unique<DATriePrivate<value_type>>();
+    compacted->build(sortedEntries);
+    if (hasTopKIndex()) {
+        compacted->build_best(d->m_bestOrder);
+    } else {
+        compacted->m_bestOrder = d->m_bestOrder;
+    }
+    d = std::move(compacted);
+}
+
 template <typename T>
 void DATrie<T>::update(const char *key, size_t len,
                        DATrie<T>::updater_type updater) {
@@ -1184,6 +2423,55 @@ int32_t DATrie<T>::exactMatchSearchRaw(const char *key, size_t len) const {
     return resultRaw;
 }
 
+template <typename T>
+void DATrie<T>::exactMatchSearchBatch(std::span<const std::string_view> keys,
+                                      std::span<value_type> results) const {
+    if (keys.size() != results.size()) {
+        throw std::invalid_argument("Size of keys and results mismatch.");
+    }
+    using Private = DATriePrivate<value_type>;
+    std::array<typename Private::npos_t, Private::MAX_BATCH_LOOKUP> npos;
+    std::array<int32_t, Private::MAX_BATCH_LOOKUP> raw;
+    for (size_t first = 0; first < keys.size();
+         first += Private::MAX_BATCH_LOOKUP) {
+        const auto n =
+            std::min(keys.size() - first, Private::MAX_BATCH_LOOKUP);
+        std::fill_n(npos.begin(), n, typename Private::npos_t());
+        d->find_batch(&keys[first], npos.data(), raw.data(), n);
+        for (size_t i = 0; i < n; ++i) {
+            if (raw[i] == Private::CEDAR_NO_PATH) {
+                raw[i] = Private::CEDAR_NO_VALUE;
+            }
+            results[first + i] = decodeImpl<T>(raw[i]);
+        }
+    }
+}
+
+template <typename T>
+void DATrie<T>::traverseBatch(std::span<const std::string_view> keys,
+                              std::span<position_type> from,
+                              std::span<value_type> results) const {
+    if (keys.size() != from.size() || keys.size() != results.size()) {
+        throw std::invalid_argument("Size of keys and results mismatch.");
+    }
+    using Private = DATriePrivate<value_type>;
+    std::array<typename Private::npos_t, Private::MAX_BATCH_LOOKUP> npos;
+    std::array<int32_t, Private::MAX_BATCH_LOOKUP> raw;
+    for (size_t first = 0; first < keys.size();
+         first += Private::MAX_BATCH_LOOKUP) {
+        const auto n =
+            std::min(keys.size() - first, Private::MAX_BATCH_LOOKUP);
+        for (size_t i = 0; i < n; ++i) {
+            npos[i] = typename Private::npos_t(from[first + i]);
+        }
+        d->find_batch(&keys[first], npos.data(), raw.data(), n);
+        for (size_t i = 0; i < n; ++i) {
+            from[first + i] = npos[i].toInt();
+            results[first + i] = decodeImpl<T>(raw[i]);
+        }
+    }
+}
+
 template <typename T>
 bool DATrie<T>::hasExactMatch(std::string_view key) const {
     return isValid(exactMatchSearch(key));
@@ -1285,7 +2573,9 @@ size_t DATrie<T>::mem_size() const {
            (sizeof(typename decltype(d->m_block)::value_type) *
             d->m_block.size()) +
            (sizeof(typename decltype(d->m_ninfo)::value_type) *
-            d->m_ninfo.size());
+            d->m_ninfo.size()) +
+           (sizeof(int32_t) * d->m_best.size()) +
+           (sizeof(int32_t) * d->m_codebook.size());
 }
 
 template class DATrie<float>;
@@ -12,6 +12,8 @@
 
 #include <libime/core/libimecore_export.h>
 
+#include <algorithm>
+#include <bit>
 #include <concepts>
 #include <cstddef>
 #include <cstdint>
@@ -19,9 +21,11 @@
 #include <istream>
 #include <memory>
 #include <ostream>
+#include <span>
 #include <string>
 #include <string_view>
 #include <tuple>
+#include <utility>
 #include <vector>
 #include <fcitx-utils/macros.h>
 
@@ -79,6 +83,98 @@ public:
     void save(const char *filename);
     void save(std::ostream &stream);
 
+    /**
+     * Load the trie from an image created by saveImage.
+     *
+     * If the image has the same byte order as the host, the file is mapped
+     * read-only and the pages are shared by every process that maps the same
+     * file. The data will only be copied when the trie is modified. Otherwise
+     * it falls back to read and convert the data like load.
+     *
+     * @since 1.1.16
+     */
+    void loadImage(const char *filename);
+    /**
+     * Load the trie from an image saved at offset of the file, like the
+     * images in the binary image format of dictionaries.
+     *
+     * The image is mapped the same as loadImage(filename).
+     *
+     * @param filename file name
+     * @param offset offset of the image, must be a multiple of 8.
+     * @return the offset right after the image, where the next image saved
+     * in the same file starts.
+     * @since 1.1.16
+     */
+    size_t loadImage(const char *filename, size_t offset);
+    /**
+     * Load the trie from an image stream, the data is always copied.
+     *
+     * @since 1.1.16
+     */
+    void loadImage(std::istream &in);
+    /**
+     * Save the trie in the native byte order image format.
+     *
+     * The size of the image is a multiple of 8, so images saved one after
+     * another from an offset that is a multiple of 8 can all be mapped.
+     *
+     * @see loadImage
+     * @since 1.1.16
+     */
+    void saveImage(const char *filename);
+    void saveImage(std::ostream &stream);
+
+    /**
+     * Whether the trie data is currently backed by a mapped image.
+     *
+     * @since 1.1.16
+     */
+    bool isMapped() const;
+
+    /**
+     * Store each tail string only once if it is the suffix of another one.
+     *
+     * Keys that end with the same string, like the same word with different
+     * codes in dictionary, can share the tail. It is meant for a trie that is
+     * only used for lookup, and the shared tail is kept by saveImage and
+     * loadImage. Modifying the trie, save or shrink_tail will unshare the tail
+     * first, and positions obtained before are no longer valid.
+     *
+     * @since 1.1.16
+     */
+    void shareTail();
+    /**
+     * Whether the tail is currently shared.
+     *
+     * @see shareTail
+     * @since 1.1.16
+     */
+    bool isTailShared() const;
+
+    /**
+     * Store values in tail as 8 or 16 bits codes of a per trie codebook.
+     *
+     * Values are replaced by at most 2^bits levels, where more common values
+     * get finer levels, so the result is lossy if there are more distinct
+     * values than that. Values are decoded on read, so the trie can be used
+     * the same as before. Like shareTail, it is meant for a trie that is only
+     * used for lookup and is kept by saveImage and loadImage. Modifying the
+     * trie, save or shrink_tail will store the quantized values as is first,
+     * and positions obtained before are no longer valid.
+     *
+     * @param bits 8 or 16.
+     * @since 1.1.16
+     */
+    void quantize(unsigned int bits = 16);
+    /**
+     * Whether the values in tail are quantized.
+     *
+     * @see quantize
+     * @since 1.1.16
+     */
+    bool isQuantized() const;
+
     size_t size() const;
     bool empty() const;
 
@@ -98,6 +194,31 @@ public:
 
     bool hasExactMatch(std::string_view key) const;
 
+    /**
+     * Look up several keys at once, results[i] is exactMatchSearch(keys[i]).
+     *
+     * The lookups are interleaved and the next node of each lookup is
+     * prefetched, so the cache misses of independent lookups overlap instead
+     * of happening one after another. It helps when the trie is much larger
+     * than the cache.
+     *
+     * @param keys keys to look up.
+     * @param results output, must have the same size as keys.
+     * @since 1.1.16
+     */
+    void exactMatchSearchBatch(std::span<const std::string_view> keys,
+                               std::span<value_type> results) const;
+
+    /**
+     * Batched version of traverse, results[i] is traverse(keys[i], from[i]).
+     *
+     * @see exactMatchSearchBatch
+     * @since 1.1.16
+     */
+    void traverseBatch(std::span<const std::string_view> keys,
+                       std::span<position_type> from,
+                       std::span<value_type> results) const;
+
     DATrie<T>::value_type traverse(std::string_view key,
                                    position_type &from) const {
         return traverse(key.data(), key.size(), from);
@@ -137,6 +258,19 @@ public:
     }
     void set(const char *key, size_t len, value_type val);
 
+    /**
+     * Replace the content of trie with given key value pairs.
+     *
+     * Keys must be sorted in byte order, which is the order of std::string.
+     * For duplicated keys the last one wins, the same as calling set in the
+     * same order. The double array is laid out in one pass, which is much
+     * faster than calling set for every key.
+     *
+     * @since 1.1.16
+     */
+    void build(
+        std::span<const std::pair<std::string_view, value_type>> entries);
+
     void update(std::string_view key, updater_type updater) {
         update(key.data(), key.size(), updater);
     }
@@ -163,6 +297,193 @@ public:
                  position_type pos = 0) const {
         return foreach(prefix.data(), prefix.size(), func, pos);
     }
+    /**
+     * Call visitor on each key under pos, without std::function and suffix.
+     *
+     * The visitor is invoked as visitor(value, key, pos) and returns bool to
+     * continue. Unlike foreach, key is the full key from the root, backed by a
+     * buffer that is reused during the traversal, so the string_view is only
+     * valid inside the visitor. pos is the same as the one passed to foreach
+     * callback.
+     *
+     * @since 1.1.16
+     */
+    template <typename Visitor>
+        requires std::predicate<Visitor &, value_type, std::string_view,
+                                position_type>
+    bool foreachKey(Visitor &&visitor, position_type pos = 0) const {
+        const auto view = rawView();
+        std::string key;
+        key.reserve(64);
+        const auto index = static_cast<uint32_t>(pos & 0xffffffffULL);
+        const auto offset = static_cast<uint32_t>(pos >> 32);
+        // Rebuild the key from the root to pos.
+        for (auto to = index; to != 0;) {
+            const auto from = static_cast<uint32_t>(view.check(to));
+            key.push_back(static_cast<char>(view.base(from) ^ to));
+            to = from;
+        }
+        std::ranges::reverse(key);
+        if (offset) {
+            const auto tailStart = view.tailStart(index);
+            key.append(view.tail + tailStart, offset - tailStart);
+            return visitTail(view, visitor, key, index, offset);
+        }
+        return visitKeys(view, visitor, key, index);
+    }
+
+    /**
+     * Call visitor on each key that starts with prefix from pos.
+     *
+     * @see foreachKey
+     * @since 1.1.16
+     */
+    template <typename Visitor>
+        requires std::predicate<Visitor &, value_type, std::string_view,
+                                position_type>
+    bool foreachKey(std::string_view prefix, Visitor &&visitor,
+                    position_type pos = 0) const {
+        if (isNoPathRaw(traverseRaw(prefix, pos))) {
+            return true;
+        }
+        return foreachKey(std::forward<Visitor>(visitor), pos);
+    }
+
+    /**
+     * Call visitor on each byte that can follow pos.
+     *
+     * The visitor is invoked as visitor(label, next) in the ascending order of
+     * label and returns bool to continue, where next is the position equals
+     * to traverse label from pos. Only the existing children are visited, so
+     * it is cheaper than traverse every possible byte when matching a set of
+     * alternatives. The end of key is not a child.
+     *
+     * @since 1.1.16
+     */
+    template <typename Visitor>
+        requires std::predicate<Visitor &, uint8_t, position_type>
+    bool foreachChild(position_type pos, Visitor &&visitor) const {
+        const auto view = rawView();
+        const auto index = static_cast<uint32_t>(pos & 0xffffffffULL);
+        auto offset = static_cast<uint32_t>(pos >> 32);
+        const int32_t base = view.base(index);
+        if (!offset && base < 0) {
+            offset = view.tailStart(index);
+        }
+        if (offset) {
+            // Only one path inside tail.
+            const auto label = static_cast<uint8_t>(view.tail[offset]);
+            if (!label) {
+                return true;
+            }
+            return visitor(label, (static_cast<position_type>(offset + 1)
+                                   << 32) |
+                                      static_cast<position_type>(index));
+        }
+        uint8_t c = view.child(index);
+        if (c == 0) {
+            // Skip the terminal, root is always its own terminal child.
+            c = view.sibling(base ^ c);
+        }
+        for (; c; c = view.sibling(base ^ c)) {
+            if (!visitor(c, static_cast<position_type>(base ^ c))) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * Layout statistics of the trie.
+     *
+     * A trie that is updated and erased for a long time may keep a lot of
+     * unused space, which can be reclaimed by compact.
+     *
+     * @see compact
+     * @since 1.1.16
+     */
+    struct Stats {
+        /// Number of keys.
+        size_t keys = 0;
+        /// Number of allocated nodes in double array.
+        size_t nodes = 0;
+        /// Number of allocated nodes that are not used.
+        size_t emptyNodes = 0;
+        /// Size of tail in bytes.
+        size_t tailBytes = 0;
+        /// Bytes in tail that no key refers to.
+        size_t deadTailBytes = 0;
+        /// Number of blocks that have no empty node.
+        size_t fullBlocks = 0;
+        /// Number of blocks that are nearly full.
+        size_t closedBlocks = 0;
+        /// Number of empty nodes in closed blocks.
+        size_t closedEmptyNodes = 0;
+        /// Number of blocks that are used for new nodes.
+        size_t openBlocks = 0;
+        /// Number of empty nodes in open blocks.
+        size_t openEmptyNodes = 0;
+    };
+
+    /**
+     * Return the layout statistics of the trie.
+     *
+     * @since 1.1.16
+     */
+    Stats stats() const;
+
+    /**
+     * Rebuild the trie with a dense layout.
+     *
+     * All keys are re-inserted with build, which drops the unused nodes and
+     * tail left by update and erase. The content of the trie is unchanged, and
+     * topK index is rebuilt if there is one. Positions obtained before are no
+     * longer valid.
+     *
+     * @see build
+     * @since 1.1.16
+     */
+    void compact();
+
+    /**
+     * Which value is considered better by topK.
+     *
+     * @since 1.1.16
+     */
+    enum class TopKOrder { Largest, Smallest };
+
+    /**
+     * Build an index of the best value under each node for topK.
+     *
+     * The index takes extra 4 bytes per node and is dropped when the trie is
+     * modified, so it is meant for a trie that is loaded once and only used
+     * for lookup.
+     *
+     * @since 1.1.16
+     */
+    void buildTopKIndex(TopKOrder order = TopKOrder::Largest);
+    /**
+     * Whether topK index is built and still valid.
+     *
+     * @since 1.1.16
+     */
+    bool hasTopKIndex() const;
+
+    /**
+     * Return at most k keys starting with prefix, best value first.
+     *
+     * With the index, this is a best first search that stops after k keys are
+     * found, instead of visiting every key under the prefix. Without the
+     * index, it falls back to enumerate all the keys, with the order passed to
+     * last buildTopKIndex, or TopKOrder::Largest. The order of keys with the
+     * same value is unspecified. If k is 0, all the keys are returned.
+     *
+     * @see buildTopKIndex
+     * @since 1.1.16
+     */
+    std::vector<std::pair<std::string, value_type>>
+    topK(std::string_view prefix, size_t k, position_type pos = 0) const;
+
     void clear();
     void shrink_tail();
 
@@ -182,6 +503,119 @@ public:
     size_t mem_size() const;
 
 private:
+    // Read-only view of the internal arrays, used by inline traversal.
+    struct RawView {
+        const int32_t *array; // pairs of base and check.
+        const uint8_t *ninfo; // pairs of sibling and child.
+        const char *tail;
+        int32_t noValue;
+        // Raw value of codes in tail, null if tail stores raw value.
+        const int32_t *codebook;
+        uint32_t valueSize;
+
+        int32_t base(uint32_t i) const { return array[2 * i]; }
+        int32_t check(uint32_t i) const { return array[(2 * i) + 1]; }
+        uint8_t sibling(uint32_t i) const { return ninfo[2 * i]; }
+        uint8_t child(uint32_t i) const { return ninfo[(2 * i) + 1]; }
+        // Tail reference with this bit points to a record of value and
+        // string offset, instead of the string.
+        static constexpr uint32_t sharedTailFlag = 1U << 30;
+
+        uint32_t tailStart(uint32_t i) const {
+            const auto ref = static_cast<uint32_t>(-base(i));
+            if (ref & sharedTailFlag) {
+                return static_cast<uint32_t>(loadTailValue(
+                    tail + (ref & ~sharedTailFlag) + valueSize));
+            }
+            return ref;
+        }
+        // end is the offset of the end of the tail string of i.
+        int32_t tailValue(uint32_t i, uint32_t end) const {
+            const auto ref = static_cast<uint32_t>(-base(i));
+            const char *data = (ref & sharedTailFlag)
+                                   ? tail + (ref & ~sharedTailFlag)
+                                   : tail + end + 1;
+            if (!codebook) {
+                return loadTailValue(data);
+            }
+            const auto *bytes = reinterpret_cast<const uint8_t *>(data);
+            if (valueSize == 1) {
+                return codebook[bytes[0]];
+            }
+            return codebook[bytes[0] | (static_cast<uint32_t>(bytes[1]) << 8)];
+        }
+        // Value in tail is always stored as little endian.
+        static int32_t loadTailValue(const char *data) {
+            const auto *bytes = reinterpret_cast<const uint8_t *>(data);
+            return static_cast<int32_t>(
+                static_cast<uint32_t>(bytes[0]) |
+                (static_cast<uint32_t>(bytes[1]) << 8) |
+                (static_cast<uint32_t>(bytes[2]) << 16) |
+                (static_cast<uint32_t>(bytes[3]) << 24));
+        }
+    };
+
+    RawView rawView() const;
+
+    template <typename Visitor>
+    static bool visitTail(const RawView &view, Visitor &visitor,
+                          std::string &key, uint32_t index, uint32_t offset) {
+        const char *tail = view.tail + offset;
+        const auto length = std::char_traits<char>::length(tail);
+        const auto raw = view.tailValue(index, offset + length);
+        if (raw == view.noValue) {
+            return true;
+        }
+        const auto size = key.size();
+        key.append(tail, length);
+        const auto pos = (static_cast<position_type>(offset + length) << 32) |
+                         static_cast<position_type>(index);
+        const bool result = visitor(std::bit_cast<value_type>(raw),
+                                    std::string_view(key), pos);
+        key.resize(size);
+        return result;
+    }
+
+    template <typename Visitor>
+    static bool visitKeys(const RawView &view, Visitor &visitor,
+                          std::string &key, uint32_t from) {
+        const int32_t base = view.base(from);
+        if (base < 0) {
+            return visitTail(view, visitor, key, from, view.tailStart(from));
+        }
+        uint8_t c = view.child(from);
+        if (from == 0) {
+            // Root is its own terminal child.
+            c = view.sibling(base ^ c);
+            if (!c) {
+                return true;
+            }
+        }
+        while (true) {
+            const auto to = static_cast<uint32_t>(base ^ c);
+            if (c == 0) {
+                const auto raw = view.base(to);
+                if (raw != view.noValue &&
+                    !visitor(std::bit_cast<value_type>(raw),
+                             std::string_view(key),
+                             static_cast<position_type>(from))) {
+                    return false;
+                }
+            } else {
+                key.push_back(static_cast<char>(c));
+                if (!visitKeys(view, visitor, key, to)) {
+                    return false;
+                }
+                key.pop_back();
+            }
+            c = view.sibling(to);
+            if (!c) {
+                break;
+            }
+        }
+        return true;
+    }
+
     std::unique_ptr<DATriePrivate<value_type>> d;
 };
 
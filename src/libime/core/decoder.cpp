@@ -12,6 +12,7 @@
 #include <functional>
 #include <limits>
 #include <memory>
+#include <optional>
 #include <queue>
 #include <ranges>
 #include <string>
@@ -21,11 +22,10 @@
 #include <unordered_set>
 #include <utility>
 #include <vector>
-#include <boost/container_hash/hash.hpp>
-#include <boost/functional/hash.hpp>
 #include <boost/ptr_container/ptr_vector.hpp>
 #include <fcitx-utils/macros.h>
 #include "languagemodel.h"
+#include "languagemodel_p.h"
 #include "lattice.h"
 #include "lattice_p.h"
 #include "segmentgraph.h"
@@ -34,36 +34,47 @@
 
 namespace libime {
 
-constexpr int MAX_BACKWARD_SEARCH_SIZE = 10000;
-
-class NBestNode {
+// Tracks the work done by a decode, and checks it against the budget.
+class DecodeTracker {
 public:
-    NBestNode(const LatticeNode *node,
-              size_t next = std::numeric_limits<size_t>::max())
-        : node_(node), next_(next) {}
+    DecodeTracker(const DecodeBudget &budget, DecodeStats &stats)
+        : budget_(budget), stats_(stats) {}
 
-    const NBestNode *next(const std::vector<NBestNode> &pool) const {
-        return next_ == std::numeric_limits<size_t>::max() ? nullptr
-                                                           : &pool[next_];
-    }
+    bool exhausted() const { return exhausted_; }
+    DecodeStats &stats() { return stats_; }
 
-    const LatticeNode *node() const { return node_; }
+    void addModelCalls(size_t calls) {
+        stats_.modelCalls += calls;
+        update(budget_.maxModelCalls &&
+               stats_.modelCalls > budget_.maxModelCalls);
+    }
 
-    // for nbest
-    float gn_ = 0.0F;
-    float fn_ = -std::numeric_limits<float>::max();
+    void addLatticeNode() {
+        ++stats_.latticeNodes;
+        update(budget_.maxLatticeNodes &&
+               stats_.latticeNodes > budget_.maxLatticeNodes);
+    }
 
 private:
-    const LatticeNode *const node_;
-    size_t next_ = std::numeric_limits<size_t>::max();
-};
+    // Reading the clock is not free, only check it once in a while.
+    static constexpr size_t clockInterval = 16;
 
-struct NBestNodeLess {
-    NBestNodeLess(const std::vector<NBestNode> &pool) : pool_(pool) {}
-    bool operator()(size_t lhs, size_t rhs) const {
-        return pool_[lhs].fn_ < pool_[rhs].fn_;
+    void update(bool overLimit) {
+        if (exhausted_) {
+            return;
+        }
+        if (overLimit ||
+            (budget_.deadline != std::chrono::steady_clock::time_point::max() &&
+             ++ticks_ % clockInterval == 0 &&
+             std::chrono::steady_clock::now() >= budget_.deadline)) {
+            exhausted_ = true;
+        }
     }
-    const std::vector<NBestNode> &pool_;
+
+    const DecodeBudget &budget_;
+    DecodeStats &stats_;
+    size_t ticks_ = 0;
+    bool exhausted_ = false;
 };
 
 class DecoderPrivate {
@@ -76,24 +87,30 @@ public:
     buildLattice(const Decoder *q, Lattice &l,
                  const std::unordered_set<const SegmentGraphNode *> &ignore,
                  const State &state, const SegmentGraph &graph,
-                 size_t frameSize, void *helper) const;
+                 size_t frameSize, void *helper,
+                 DecodeTracker &tracker) const;
 
     void
     forwardSearch(const Decoder *q, const SegmentGraph &graph, Lattice &lattice,
                   const std::unordered_set<const SegmentGraphNode *> &ignore,
-                  size_t beamSize) const;
+                  size_t beamSize, DecodeTracker &tracker) const;
     void backwardSearch(const SegmentGraph &graph, Lattice &l, size_t nbest,
-                        float max, float min, size_t beamSize) const;
+                        float max, float min, size_t beamSize,
+                        DecodeTracker &tracker) const;
+    // Continue the backward search until count more sentences are found.
+    size_t searchMore(Lattice &l, size_t count, DecodeTracker &tracker) const;
 
     const Dictionary *dict_;
     const LanguageModelBase *model_;
+    bool partialSort_ = false;
+    Decoder::ParallelFor parallelFor_;
 };
 
 bool DecoderPrivate::buildLattice(
     const Decoder *q, Lattice &l,
     const std::unordered_set<const SegmentGraphNode *> &ignore,
     const State &state, const SegmentGraph &graph, size_t frameSize,
-    void *helper) const {
+    void *helper, DecodeTracker &tracker) const {
     LatticeMap &lattice = l.d_ptr->lattice_;
 
     // Create the root node.
@@ -103,15 +120,17 @@ bool DecoderPrivate::buildLattice(
                                  {nullptr, &graph.start()}, state, 0));
     }
 
-    // std::vector is used here to make sure std::make_heap works.
-    std::unordered_map<
-        std::pair<const SegmentGraphNode *, const SegmentGraphNode *>,
-        std::vector<std::unique_ptr<LatticeNode>>,
-        boost::hash<
-            std::pair<const SegmentGraphNode *, const SegmentGraphNode *>>>
-        frames;
+    struct Frame {
+        const SegmentGraphNode *from;
+        const SegmentGraphNode *to;
+        // std::vector is used here to make sure std::make_heap works.
+        std::vector<std::unique_ptr<LatticeNode>> nodes;
+    };
+    // Frames are indexed by the end of path. Only a few paths end at the same
+    // node, so the start of path is searched linearly.
+    std::vector<std::vector<Frame>> frames(graph.size() + 1);
 
-    auto dictMatchCallback = [this, &graph, &frames, q, frameSize](
+    auto dictMatchCallback = [this, &graph, &frames, &tracker, q, frameSize](
                                  const SegmentGraphPath &path, WordNode &word,
                                  float adjust,
                                  std::unique_ptr<LatticeNodeData> data) {
@@ -119,8 +138,19 @@ bool DecoderPrivate::buildLattice(
             auto idx = model_->index(word.word());
             word.setIdx(idx);
         }
+        ++tracker.stats().dictionaryMatches;
         assert(path.front());
-        auto &frame = frames[std::make_pair(path.front(), path.back())];
+        assert(path.back());
+        auto &framesTo = frames[path.back()->index()];
+        auto iter = std::ranges::find(framesTo, path.front(), &Frame::from);
+        if (iter == framesTo.end()) {
+            iter = framesTo.insert(iter, {path.front(), path.back(), {}});
+        }
+        auto &frame = iter->nodes;
+        // Out of budget, only keep one node to make sure the path exists.
+        if (tracker.exhausted() && !frame.empty()) {
+            return;
+        }
         const bool applyFrameSize =
             path.front() != &graph.start() && frameSize > 0;
         auto *node = q->createLatticeNode(
@@ -131,6 +161,7 @@ bool DecoderPrivate::buildLattice(
         }
 
         frame.emplace_back(node);
+        tracker.addLatticeNode();
         if (!applyFrameSize) {
             return;
         }
@@ -138,32 +169,40 @@ bool DecoderPrivate::buildLattice(
         auto scoreGreaterThan = [](const auto &lhs, const auto &rhs) {
             return lhs->score() > rhs->score();
         };
+        // Only an approximate rank is needed, so use the unigram score.
+        auto wordScore = [this](const LatticeNode &node) {
+            return model_->unigramScore(node);
+        };
         // Just reach the limit, initialize the heap.
         if (frame.size() == frameSize) {
             for (auto &n : frame) {
                 // Cache the score here.
-                n->setScore(model_->singleWordScore(n->word()) + n->cost());
+                n->setScore(wordScore(*n) + n->cost());
             }
+            tracker.addModelCalls(frame.size());
             std::make_heap(frame.begin(), frame.end(), scoreGreaterThan);
         } else if (frame.size() == frameSize + 1) {
             // Cache the score here.
-            node->setScore(model_->singleWordScore(node->word()) +
-                           node->cost());
+            node->setScore(wordScore(*node) + node->cost());
+            tracker.addModelCalls(1);
             // Take a short cut, check if node score greater than minimum
             if (scoreGreaterThan(node, frame[0])) {
                 std::push_heap(frame.begin(), frame.end(), scoreGreaterThan);
                 std::pop_heap(frame.begin(), frame.end(), scoreGreaterThan);
             }
             frame.pop_back();
+            ++tracker.stats().prunedNodes;
         }
     };
 
     dict_->matchPrefix(graph, dictMatchCallback, ignore, helper);
 
-    for (auto &[path, nodes] : frames) {
-        auto &latticeUnit = lattice[path.second];
-        for (auto &node : nodes) {
-            latticeUnit.push_back(node.release());
+    for (auto &framesTo : frames) {
+        for (auto &frame : framesTo) {
+            auto &latticeUnit = lattice[frame.to];
+            for (auto &node : frame.nodes) {
+                latticeUnit.push_back(node.release());
+            }
         }
     }
     if (!lattice.contains(&graph.end())) {
@@ -180,245 +219,402 @@ bool DecoderPrivate::buildLattice(
 void DecoderPrivate::forwardSearch(
     const Decoder *q, const SegmentGraph &graph, Lattice &l,
     const std::unordered_set<const SegmentGraphNode *> &ignore,
-    size_t beamSize) const {
-    State state;
+    size_t beamSize, DecodeTracker &tracker) const {
     LatticeMap &lattice = l.d_ptr->lattice_;
-    std::unordered_map<const SegmentGraphNode *,
-                       std::tuple<float, LatticeNode *, State>>
-        unknownIdCache;
+    // Buffers for scoring a node against all its parents at once, one for
+    // each task running in parallel.
+    struct ScoreBuffers {
+        std::vector<const State *> parentStates;
+        std::vector<float> scores;
+        std::vector<State> states;
+    };
+    // Indexed by SegmentGraphNode::index of from.
+    std::vector<std::optional<std::tuple<float, LatticeNode *, State>>>
+        unknownIdCache(graph.size() + 1);
     const auto *start = &graph.start();
-    // forward search
-    auto updateForNode = [&](const SegmentGraphBase &,
-                             const SegmentGraphNode *graphNode) {
-        if (graphNode == start || !lattice.contains(graphNode) ||
-            ignore.contains(graphNode)) {
-            return true;
+
+    // Find the best parent of node, returns the number of model calls.
+    // unknownIdCache is only written if updateCache is true.
+    auto updateNode = [&](LatticeNode &node, ScoreBuffers &buffers,
+                          bool updateCache) -> size_t {
+        const auto *from = node.from();
+        assert(graph.checkNodeInGraph(from));
+        float maxScore = -std::numeric_limits<float>::max();
+        LatticeNode *maxNode = nullptr;
+        State maxState;
+        size_t modelCalls = 0;
+        bool isUnknown = model_->isNodeUnknown(node);
+        if (isUnknown && unknownIdCache[from->index()]) {
+            std::tie(maxScore, maxNode, maxState) =
+                *unknownIdCache[from->index()];
         }
-        auto &latticeNodes = lattice[graphNode];
-        for (auto &node : latticeNodes) {
-            const auto *from = node.from();
-            assert(graph.checkNodeInGraph(from));
-            float maxScore = -std::numeric_limits<float>::max();
-            LatticeNode *maxNode = nullptr;
-            State maxState;
-            bool isUnknown = model_->isNodeUnknown(node);
-            if (isUnknown) {
-                auto iter = unknownIdCache.find(from);
-                if (iter != unknownIdCache.end()) {
-                    std::tie(maxScore, maxNode, maxState) = iter->second;
-                }
-            }
 
-            if (!maxNode) {
-                auto iter = lattice.find(from);
-                // assert(iter != lattice.end());
-                if (iter == lattice.end()) {
-                    continue;
-                }
-                auto &searchFrom = iter->second;
-                auto searchSize = beamSize;
-                if (searchSize) {
-                    searchSize = std::min(searchSize, lattice[from].size());
+        if (!maxNode) {
+            auto *searchFrom = lattice.find(from);
+            // assert(searchFrom);
+            if (!searchFrom) {
+                return 0;
+            }
+            // Out of budget, only take the best parent.
+            auto searchSize = tracker.exhausted() ? 1 : beamSize;
+            if (searchSize) {
+                searchSize = std::min(searchSize, searchFrom->size());
+            } else {
+                searchSize = searchFrom->size();
+            }
+            if (partialSort_) {
+                if (updateCache) {
+                    lattice.ensureSorted(from, searchSize);
                 } else {
-                    searchSize = lattice[from].size();
-                }
-                for (auto &parent : searchFrom | std::views::take(searchSize)) {
-                    auto score = parent.score() +
-                                 model_->score(parent.state(), node, state);
-                    if (score > maxScore) {
-                        maxScore = score;
-                        maxNode = &parent;
-                        maxState = state;
-                    }
+                    // Tasks run in parallel must not sort the shared parent
+                    // group, it is sorted before the level starts.
+                    assert(lattice.sortedSize(from) >= searchSize);
                 }
-
-                if (isUnknown) {
-                    unknownIdCache.emplace(
-                        std::piecewise_construct, std::forward_as_tuple(from),
-                        std::forward_as_tuple(maxScore, maxNode, maxState));
+            }
+            modelCalls = searchSize;
+            auto &[parentStates, scores, states] = buffers;
+            parentStates.clear();
+            for (auto &parent : *searchFrom | std::views::take(searchSize)) {
+                parentStates.push_back(&parent.state());
+            }
+            scores.resize(searchSize);
+            states.resize(searchSize);
+            model_->scoreBatch(parentStates, node, scores, states);
+            for (size_t i = 0; i < searchSize; i++) {
+                auto &parent = (*searchFrom)[i];
+                auto score = parent.score() + scores[i];
+                if (score > maxScore) {
+                    maxScore = score;
+                    maxNode = &parent;
+                    maxState = states[i];
                 }
             }
 
-            assert(maxNode);
-            node.setScore(maxScore + node.cost());
-            node.setPrev(maxNode);
-            node.state() = maxState;
+            if (isUnknown && updateCache) {
+                unknownIdCache[from->index()].emplace(maxScore, maxNode,
+                                                      maxState);
+            }
         }
+
+        assert(maxNode);
+        node.setScore(maxScore + node.cost());
+        node.setPrev(maxNode);
+        node.state() = maxState;
+        return modelCalls;
+    };
+
+    auto sortNodes = [&](const SegmentGraphNode *graphNode,
+                         const LatticeMap::NodeList &latticeNodes) {
         if (q->needSort(graph, graphNode)) {
-            latticeNodes.sort(
-                [](const LatticeNode &lhs, const LatticeNode &rhs) {
-                    return lhs.score() > rhs.score();
-                });
+            // Children only take the best beamSize nodes, others sort more
+            // with ensureSorted when they need.
+            lattice.sort(graphNode, partialSort_ && beamSize
+                                        ? beamSize
+                                        : latticeNodes.size());
         }
+    };
+
+    ScoreBuffers buffers;
+    // forward search
+    auto updateForNode = [&](const SegmentGraphBase &,
+                             const SegmentGraphNode *graphNode) {
+        if (graphNode == start || ignore.contains(graphNode)) {
+            return true;
+        }
+        auto *nodes = lattice.find(graphNode);
+        if (!nodes) {
+            return true;
+        }
+        for (auto &node : *nodes) {
+            tracker.addModelCalls(updateNode(node, buffers, true));
+        }
+        sortNodes(graphNode, *nodes);
         return true;
     };
 
-    graph.bfs(start, updateForNode);
+    if (!parallelFor_) {
+        graph.bfs(start, updateForNode);
+        updateForNode(graph, nullptr);
+        return;
+    }
+
+    // Nodes in the same level only depend on the nodes of lower levels, so
+    // they can be updated at the same time. Level 0 is start, or the nodes
+    // done by the last decode. Words may span multiple segments, so the
+    // level comes from the from node of lattice nodes.
+    std::vector<std::vector<const SegmentGraphNode *>> levels;
+    std::vector<std::optional<size_t>> levelOf(graph.size() + 1);
+    levelOf[start->index()] = 0;
+    for (size_t i = start->index() + 1; i <= graph.size(); i++) {
+        for (const auto &graphNode : graph.nodes(i)) {
+            bool reachable = false;
+            for (const auto &prev : graphNode.prevs()) {
+                reachable = reachable || levelOf[prev.index()].has_value();
+            }
+            // Not reachable from start.
+            if (!reachable) {
+                continue;
+            }
+            auto *nodes = lattice.find(&graphNode);
+            if (ignore.contains(&graphNode) || !nodes) {
+                levelOf[i] = 0;
+                continue;
+            }
+            size_t level = 0;
+            for (const auto &node : *nodes) {
+                level = std::max(level,
+                                 levelOf[node.from()->index()].value_or(0));
+            }
+            levelOf[i] = level + 1;
+            if (levels.size() <= level) {
+                levels.resize(level + 1);
+            }
+            levels[level].push_back(&graphNode);
+        }
+    }
+
+    for (const auto &level : levels) {
+        // Do everything that writes to the shared state first, so the tasks
+        // only write to their own group of nodes.
+        for (const auto *graphNode : level) {
+            for (auto &node : *lattice.find(graphNode)) {
+                const auto *from = node.from();
+                if (partialSort_ && lattice.contains(from)) {
+                    lattice.ensureSorted(
+                        from, beamSize ? beamSize
+                                       : std::numeric_limits<size_t>::max());
+                }
+                if (model_->isNodeUnknown(node) &&
+                    !unknownIdCache[from->index()]) {
+                    tracker.addModelCalls(updateNode(node, buffers, true));
+                }
+            }
+        }
+        std::vector<size_t> modelCalls(level.size());
+        parallelFor_(level.size(), [&](size_t i) {
+            // The task may run on the thread calling decode, where the cache
+            // is in use, and the cache is not thread safe.
+            LanguageModelCacheScope noCache(nullptr);
+            ScoreBuffers taskBuffers;
+            auto &nodes = *lattice.find(level[i]);
+            for (auto &node : nodes) {
+                modelCalls[i] += updateNode(node, taskBuffers, false);
+            }
+            sortNodes(level[i], nodes);
+        });
+        for (auto calls : modelCalls) {
+            tracker.addModelCalls(calls);
+        }
+    }
     updateForNode(graph, nullptr);
 }
 
-std::string concatNBest(const std::vector<NBestNode> &pool,
-                        const NBestNode *node, std::string_view sep = "") {
-    std::string result;
-    while (node) {
-        result.append(node->node()->word());
-        result.append(sep.data(), sep.size());
+// Returns a callable to iterate over the words from node to the end.
+auto nbestNextWord(const std::vector<NBestNode> &pool, const NBestNode *node) {
+    return [&pool, node]() mutable -> const std::string * {
+        if (!node) {
+            return nullptr;
+        }
+        const auto *word = &node->node()->word();
         node = node->next(pool);
-    }
-    return result;
+        return word;
+    };
 }
 
 void DecoderPrivate::backwardSearch(const SegmentGraph &graph, Lattice &l,
                                     size_t nbest, float max, float min,
-                                    size_t beamSize) const {
+                                    size_t beamSize,
+                                    DecodeTracker &tracker) const {
     auto &lattice = l.d_ptr->lattice_;
-    State state;
     // backward search
     assert(lattice[&graph.start()].size() == 1);
     assert(lattice[nullptr].size() == 1);
     auto *pos = &lattice[nullptr][0];
     l.d_ptr->nbests_.push_back(pos->toSentenceResult());
 
-    struct ModelLookupCacheHash {
-        size_t operator()(const std::pair<const LatticeNode *,
-                                          const LatticeNode *> &key) const {
-            size_t seed = std::hash<const LatticeNode *>()(key.first);
-            boost::hash_combine(seed,
-                                std::hash<const LatticeNode *>()(key.second));
-            return seed;
-        }
-    };
-    std::unordered_map<std::pair<const LatticeNode *, const LatticeNode *>,
-                       float, ModelLookupCacheHash>
-        cache;
+    l.d_ptr->search_ = std::make_unique<NBestSearch>(
+        &lattice[&graph.start()][0], pos, max, min, beamSize);
     if (nbest > 1) {
-        std::unordered_set<std::string> dup;
-        dup.insert(l.d_ptr->nbests_[0].toString());
-
-        std::vector<NBestNode> pool;
-        pool.reserve(MAX_BACKWARD_SEARCH_SIZE + 1);
+        searchMore(l, nbest, tracker);
+    }
+}
 
-        NBestNodeLess cmp(pool);
-        using PriorityQueueType =
-            std::priority_queue<size_t, std::vector<size_t>, NBestNodeLess>;
-        PriorityQueueType q(cmp);
-        PriorityQueueType result(cmp);
+size_t DecoderPrivate::searchMore(Lattice &l, size_t count,
+                                  DecodeTracker &tracker) const {
+    auto &lattice = l.d_ptr->lattice_;
+    auto &search = *l.d_ptr->search_;
+    if (search.done_) {
+        return 0;
+    }
+    State state;
+    auto &pool = search.pool_;
+    auto &q = search.queue_;
+    auto &dup = search.dup_;
+    auto &cache = search.modelCache_;
+    const auto *bos = search.bos_;
+    const auto *eos = search.eos_;
+    const auto max = search.max_;
+    const auto min = search.min_;
+
+    // The sentence from forward search is not in the pool, so it is compared
+    // with bestHash and bestSentence directly.
+    const auto bestHash = l.d_ptr->nbests_[0].textHash();
+    const auto &bestSentence = l.d_ptr->nbests_[0].sentence();
+    auto isDuplicate = [&pool, &dup, bestHash,
+                        &bestSentence](const NBestNode *node, size_t hash) {
+        if (hash == bestHash &&
+            details::wordsTextEquals(
+                nbestNextWord(pool, node),
+                [iter = bestSentence.begin(), end = bestSentence.end()]()
+                    mutable -> const std::string * {
+                    return iter == end ? nullptr : &(*iter++)->word();
+                })) {
+            return true;
+        }
+        auto [begin, end] = dup.equal_range(hash);
+        return std::any_of(begin, end, [&pool, node](const auto &item) {
+            return details::wordsTextEquals(
+                nbestNextWord(pool, node),
+                nbestNextWord(pool, &pool[item.second]));
+        });
+    };
 
-        auto *eos = &lattice[nullptr][0];
-        auto pushNewNBestNode =
-            [&](const LatticeNode *node,
+    auto pushNewNBestNode =
+        [&pool](const LatticeNode *node,
                 size_t next = std::numeric_limits<size_t>::max()) -> size_t {
-            pool.emplace_back(node, next);
-            return pool.size() - 1;
-        };
+        pool.emplace_back(node, next);
+        return pool.size() - 1;
+    };
 
+    if (pool.empty()) {
+        // Nodes in the queue are referenced while new nodes are pushed, so
+        // pool must not reallocate.
+        pool.reserve(MAX_BACKWARD_SEARCH_SIZE + 1);
         q.push(pushNewNBestNode(eos));
-        auto *bos = &lattice[&graph.start()][0];
-        while (!q.empty()) {
-            size_t nodeIdx = q.top();
-            q.pop();
-            const auto &node = pool[nodeIdx];
-            if (bos == node.node()) {
-                auto sentence = concatNBest(pool, &node);
-                if (dup.contains(sentence)) {
-                    continue;
-                }
+    }
 
-                if (eos->score() - node.fn_ > max) {
-                    break;
-                }
-                result.push(nodeIdx);
-                if (result.size() >= nbest) {
-                    break;
-                }
-                dup.insert(sentence);
+    NBestNodeLess cmp(pool);
+    std::priority_queue<size_t, std::vector<size_t>, NBestNodeLess> result(
+        cmp);
+    // Out of budget, only the sentences found so far are kept.
+    while (!q.empty() && !tracker.exhausted()) {
+        size_t nodeIdx = q.top();
+        q.pop();
+        const auto &node = pool[nodeIdx];
+        if (bos == node.node()) {
+            const auto hash =
+                details::wordsTextHash(nbestNextWord(pool, &node));
+            if (isDuplicate(&node, hash)) {
+                continue;
+            }
+
+            if (eos->score() - node.fn_ > max) {
+                // Everything left in the queue is worse.
+                search.done_ = true;
+                break;
+            }
+            result.push(nodeIdx);
+            dup.emplace(hash, nodeIdx);
+            if (result.size() >= count) {
+                break;
+            }
+        } else {
+            if (pool.size() >= MAX_BACKWARD_SEARCH_SIZE) {
+                continue;
+            }
+            auto searchSize = search.beamSize_;
+            const auto *from_node = node.node();
+            if (searchSize) {
+                searchSize =
+                    std::min(searchSize, lattice[from_node->from()].size());
             } else {
-                if (pool.size() >= MAX_BACKWARD_SEARCH_SIZE) {
-                    continue;
-                }
-                auto searchSize = beamSize;
-                const auto *from_node = node.node();
-                if (searchSize) {
-                    searchSize =
-                        std::min(searchSize, lattice[from_node->from()].size());
+                searchSize = lattice[from_node->from()].size();
+            }
+            if (partialSort_) {
+                lattice.ensureSorted(from_node->from(), searchSize);
+            }
+            for (auto &from :
+                 lattice[from_node->from()] | std::views::take(searchSize)) {
+                float score;
+
+                if (node.node()->prev() == &from) {
+                    // We can skip the model call if the node is the same as
+                    // the previous one from forward search.
+                    // Following should hold:
+                    // node.score = from.score + model_score + node.cost
+                    score = node.node()->score() - from.score();
                 } else {
-                    searchSize = lattice[from_node->from()].size();
-                }
-                for (auto &from : lattice[from_node->from()] |
-                                      std::views::take(searchSize)) {
-                    float score;
-
-                    if (node.node()->prev() == &from) {
-                        // We can skip the model call if the node is the same as
-                        // the previous one from forward search.
-                        // Following should hold:
-                        // node.score = from.score + model_score + node.cost
-                        score = node.node()->score() - from.score();
+                    auto it = cache.find(std::make_pair(&from, node.node()));
+                    if (it != cache.end()) {
+                        score = it->second;
                     } else {
-                        auto it =
-                            cache.find(std::make_pair(&from, node.node()));
-                        if (it != cache.end()) {
-                            score = it->second;
-                        } else {
-                            score = model_->score(from.state(), *node.node(),
-                                                  state);
-                            cache[std::make_pair(&std::as_const(from),
-                                                 node.node())] = score;
-                        }
-                        score += node.node()->cost();
-                    }
-                    if (&from != bos && score < min) {
-                        continue;
+                        score =
+                            model_->score(from.state(), *node.node(), state);
+                        tracker.addModelCalls(1);
+                        cache[std::make_pair(&std::as_const(from),
+                                             node.node())] = score;
                     }
+                    score += node.node()->cost();
+                }
+                if (&from != bos && score < min) {
+                    continue;
+                }
 
-                    const float gn = score + node.gn_;
-                    const float fn = gn + from.score();
-                    // fn should be the best possible score for the current
-                    // sentence, if diff is worse than the diff max, we can skip
-                    // it.
-                    if (eos->score() - fn <= max) {
-                        size_t parentIdx = pushNewNBestNode(&from, nodeIdx);
-                        pool[parentIdx].gn_ = gn;
-                        pool[parentIdx].fn_ = fn;
-                        q.push(parentIdx);
-                        if (pool.size() >= MAX_BACKWARD_SEARCH_SIZE) {
-                            break;
-                        }
-                    } else if (node.node()->prev() == &from) {
-                        // lattice should be sorted. So this is the best
-                        // possible score for the current sentence, if diff is
-                        // larger than max, we can skip the rest of the parent
-                        // nodes.
+                const float gn = score + node.gn_;
+                const float fn = gn + from.score();
+                // fn should be the best possible score for the current
+                // sentence, if diff is worse than the diff max, we can skip
+                // it.
+                if (eos->score() - fn <= max) {
+                    size_t parentIdx = pushNewNBestNode(&from, nodeIdx);
+                    pool[parentIdx].gn_ = gn;
+                    pool[parentIdx].fn_ = fn;
+                    q.push(parentIdx);
+                    if (pool.size() >= MAX_BACKWARD_SEARCH_SIZE) {
                         break;
                     }
+                } else if (node.node()->prev() == &from) {
+                    // lattice should be sorted. So this is the best possible
+                    // score for the current sentence, if diff is larger than
+                    // max, we can skip the rest of the parent nodes.
+                    break;
                 }
             }
         }
-
-        while (!result.empty()) {
-            size_t nodeIdx = result.top();
-            result.pop();
-            const auto &node = pool[nodeIdx];
-            // loop twice to avoid problem
-            size_t count = 0;
-            // skip bos
-            const auto *pivot = node.next(pool);
-            while (pivot) {
-                pivot = pivot->next(pool);
-                count++;
-            }
-            SentenceResult::Sentence sentence;
-            sentence.reserve(count);
-            pivot = node.next(pool);
-            while (pivot) {
-                if (pivot->node()->to()) {
-                    sentence.emplace_back(pivot->node());
-                }
-                pivot = pivot->next(pool);
+    }
+    if (q.empty()) {
+        search.done_ = true;
+    }
+    // Pool only grows, so the limit is hit if the pool is full now.
+    tracker.stats().backwardSearchPoolSize = pool.size();
+    tracker.stats().backwardSearchLimitReached =
+        pool.size() >= MAX_BACKWARD_SEARCH_SIZE;
+
+    const auto found = result.size();
+    while (!result.empty()) {
+        size_t nodeIdx = result.top();
+        result.pop();
+        const auto &node = pool[nodeIdx];
+        // loop twice to avoid problem
+        size_t length = 0;
+        // skip bos
+        const auto *pivot = node.next(pool);
+        while (pivot) {
+            pivot = pivot->next(pool);
+            length++;
+        }
+        SentenceResult::Sentence sentence;
+        sentence.reserve(length);
+        pivot = node.next(pool);
+        while (pivot) {
+            if (pivot->node()->to()) {
+                sentence.emplace_back(pivot->node());
             }
-            l.d_ptr->nbests_.emplace_back(std::move(sentence), node.fn_);
+            pivot = pivot->next(pool);
         }
+        l.d_ptr->nbests_.emplace_back(std::move(sentence), node.fn_);
     }
+    return found;
 }
 
 Decoder::Decoder(const Dictionary *dict, const LanguageModelBase *model)
@@ -436,35 +632,109 @@ const LanguageModelBase *Decoder::model() const {
     return d->model_;
 }
 
+bool Decoder::partialSort() const {
+    FCITX_D();
+    return d->partialSort_;
+}
+
+void Decoder::setPartialSort(bool partialSort) {
+    FCITX_D();
+    d->partialSort_ = partialSort;
+}
+
+void Decoder::setParallelFor(ParallelFor parallelFor) {
+    FCITX_D();
+    d->parallelFor_ = std::move(parallelFor);
+}
+
 bool Decoder::decode(Lattice &l, const SegmentGraph &graph, size_t nbest,
                      const State &beginState, float max, float min,
                      size_t beamSize, size_t frameSize, void *helper) const {
+    return decode(l, graph, nbest, beginState, max, min, beamSize, frameSize,
+                  helper, DecodeOptions());
+}
+
+bool Decoder::decode(Lattice &l, const SegmentGraph &graph, size_t nbest,
+                     const State &beginState, float max, float min,
+                     size_t beamSize, size_t frameSize, void *helper,
+                     const DecodeOptions &options) const {
     FCITX_D();
+    LanguageModelCache *cache = options.cache;
+    const DecodeBudget &budget = options.budget;
+    DecodeStats *stats = options.stats;
     LatticeMap &lattice = l.d_ptr->lattice_;
+    // Nodes created by createLatticeNodeImpl are owned by the lattice.
+    LatticeArenaScope arenaScope(&l.d_ptr->arena_);
+    LanguageModelCacheScope cacheScope(cache);
+    DecodeStats localStats;
+    DecodeStats &decodeStats = stats ? *stats : localStats;
+    decodeStats = DecodeStats();
+    const size_t cacheHits = cache ? cache->hits() : 0;
+    DecodeTracker tracker(budget, decodeStats);
+    // An incomplete lattice misses nodes, start over instead of reusing it.
+    if (l.d_ptr->incomplete_) {
+        lattice.clear();
+        l.d_ptr->incomplete_ = false;
+    }
     // Clear the result.
     l.d_ptr->nbests_.clear();
+    l.d_ptr->search_.reset();
     // Remove end node.
     lattice.erase(nullptr);
     std::unordered_set<const SegmentGraphNode *> ignore;
     // Add existing SegmentGraphNode to ignore set.
-    for (auto &p : lattice) {
-        ignore.insert(p.first);
-    }
-
+    lattice.foreach(
+        [&ignore](const SegmentGraphNode *node, const LatticeMap::NodeList &) {
+            ignore.insert(node);
+        });
+
+    auto finish = [&decodeStats, &tracker, cache, cacheHits]() {
+        decodeStats.degraded = tracker.exhausted();
+        if (cache) {
+            decodeStats.cacheHits = cache->hits() - cacheHits;
+        }
+    };
     auto t0 = std::chrono::high_resolution_clock::now();
+    auto phaseStart = std::chrono::steady_clock::now();
+    auto phaseTime = [&phaseStart]() {
+        auto now = std::chrono::steady_clock::now();
+        auto duration = now - phaseStart;
+        phaseStart = now;
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(duration);
+    };
 
     if (!d->buildLattice(this, l, ignore, beginState, graph, frameSize,
-                         helper)) {
+                         helper, tracker)) {
+        decodeStats.buildLatticeTime = phaseTime();
+        l.d_ptr->incomplete_ = l.d_ptr->degraded_ = tracker.exhausted();
+        finish();
         return false;
     }
+    decodeStats.buildLatticeTime = phaseTime();
     LIBIME_DEBUG() << "Build Lattice: " << millisecondsTill(t0);
-    d->forwardSearch(this, graph, l, ignore, beamSize);
+    d->forwardSearch(this, graph, l, ignore, beamSize, tracker);
+    decodeStats.forwardSearchTime = phaseTime();
     LIBIME_DEBUG() << "Forward Search: " << millisecondsTill(t0);
-    d->backwardSearch(graph, l, nbest, max, min, nbest * 2);
+    l.d_ptr->incomplete_ = tracker.exhausted();
+    d->backwardSearch(graph, l, nbest, max, min, nbest * 2, tracker);
+    decodeStats.backwardSearchTime = phaseTime();
     LIBIME_DEBUG() << "Backward Search: " << millisecondsTill(t0);
+    l.d_ptr->degraded_ = tracker.exhausted();
+    finish();
     return true;
 }
 
+size_t Decoder::nextSentences(Lattice &l, size_t count) const {
+    FCITX_D();
+    if (!l.d_ptr->search_ || !count) {
+        return 0;
+    }
+    DecodeBudget budget;
+    DecodeStats stats;
+    DecodeTracker tracker(budget, stats);
+    return d->searchMore(l, count, tracker);
+}
+
 LatticeNode *Decoder::createLatticeNodeImpl(
     const SegmentGraphBase & /*unused*/, const LanguageModelBase * /*unused*/,
     std::string_view word, WordIndex idx, SegmentGraphPath path,
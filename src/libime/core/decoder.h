@@ -6,7 +6,9 @@
 #ifndef _FCITX_LIBIME_CORE_DECODER_H_
 #define _FCITX_LIBIME_CORE_DECODER_H_
 
+#include <chrono>
 #include <cstddef>
+#include <functional>
 #include <limits>
 #include <memory>
 #include <string_view>
@@ -23,6 +25,94 @@ namespace libime {
 class DecoderPrivate;
 class Dictionary;
 
+/**
+ * Limits of the work done by a single Decoder::decode.
+ *
+ * Once any limit is reached, the decoder keeps fewer lattice nodes and
+ * parents for the rest of decoding, stops searching more sentences after the
+ * best one, and marks the lattice as degraded.
+ *
+ * @see Lattice::isDegraded
+ * @since 1.1.16
+ */
+struct DecodeBudget {
+    /**
+     * Deadline of decoding, no deadline by default.
+     *
+     * The deadline and the other limits are checked as nodes are scored.
+     * With Decoder::setParallelFor, they are only checked between the levels
+     * of forward search, so decode may run over by the time of one level.
+     */
+    std::chrono::steady_clock::time_point deadline =
+        std::chrono::steady_clock::time_point::max();
+    /// Maximum number of language model calls, 0 means no limit.
+    size_t maxModelCalls = 0;
+    /// Maximum number of newly created lattice nodes, 0 means no limit.
+    size_t maxLatticeNodes = 0;
+};
+
+/**
+ * Statistics of a single Decoder::decode.
+ *
+ * @since 1.1.16
+ */
+struct DecodeStats {
+    /// Wall time of building the lattice.
+    std::chrono::nanoseconds buildLatticeTime{0};
+    /// Wall time of forward search.
+    std::chrono::nanoseconds forwardSearchTime{0};
+    /// Wall time of backward search.
+    std::chrono::nanoseconds backwardSearchTime{0};
+    /// Number of words matched by the dictionary.
+    size_t dictionaryMatches = 0;
+    /// Number of lattice nodes created.
+    size_t latticeNodes = 0;
+    /// Number of lattice nodes dropped because of the frame size.
+    size_t prunedNodes = 0;
+    /// Number of language model score calls.
+    size_t modelCalls = 0;
+    /// Number of scores found in the LanguageModelCache.
+    size_t cacheHits = 0;
+    /// Number of nodes in the pool of backward search.
+    size_t backwardSearchPoolSize = 0;
+    /// Whether backward search stopped at its maximum pool size.
+    bool backwardSearchLimitReached = false;
+    /// Whether decode ran out of the budget, same as Lattice::isDegraded.
+    bool degraded = false;
+};
+
+/**
+ * Extra options of Decoder::decode.
+ *
+ * @since 1.1.16
+ */
+struct DecodeOptions {
+    /**
+     * Used by the language model to reuse the scores from the previous
+     * decode if not null, see LanguageModelCache.
+     */
+    LanguageModelCache *cache = nullptr;
+    /// Limits of the work done by decode.
+    DecodeBudget budget;
+    /// Filled with the statistics of decode if not null.
+    DecodeStats *stats = nullptr;
+};
+
+/**
+ * Decoder finds the best sentences of a segment graph with the dictionary
+ * and the language model.
+ *
+ * decode is const and may be called from multiple threads at the same time
+ * with one decoder, as long as:
+ * - each thread uses its own Lattice, LanguageModelCache and helper,
+ * - the dictionary and the language model are not changed meanwhile, e.g. by
+ *   adding words or learning history, and
+ * - the options of the decoder, like setPartialSort, are not changed
+ *   meanwhile.
+ *
+ * StaticLanguageModelFile can be shared by the language models of different
+ * decoders as well.
+ */
 class LIBIMECORE_EXPORT Decoder {
     friend class DecoderPrivate;
 
@@ -36,6 +126,52 @@ public:
     const Dictionary *dict() const;
     const LanguageModelBase *model() const;
 
+    /**
+     * Whether lattice nodes are only partially sorted.
+     *
+     * @see setPartialSort
+     * @since 1.1.16
+     */
+    bool partialSort() const;
+    /**
+     * Only keep the best nodes of each lattice node group sorted.
+     *
+     * By default, all nodes ending at a SegmentGraphNode are sorted by score
+     * after forward search. With partial sort, only the best beamSize nodes
+     * are sorted, which is all the search itself needs. Use
+     * Lattice::sortedSize to know how many nodes are in order.
+     *
+     * @since 1.1.16
+     */
+    void setPartialSort(bool partialSort);
+
+    /**
+     * Run task(i) for every i in [0, count), and return when all are done.
+     *
+     * @since 1.1.16
+     */
+    using ParallelFor = std::function<void(
+        size_t count, const std::function<void(size_t)> &task)>;
+
+    /**
+     * Score independent lattice node groups in parallel.
+     *
+     * The segment graph nodes are put into levels, where each node only
+     * depends on the nodes of lower levels. The node groups within one level
+     * are scored and sorted with parallelFor, which usually runs the tasks on
+     * a thread pool owned by the caller. The result is the same as the
+     * serial forward search.
+     *
+     * The language model and dictionary must be safe to be read from multiple
+     * threads. LanguageModelCache is not used by the tasks run in parallel,
+     * even if parallelFor runs some of them on the calling thread. The limits
+     * of DecodeBudget are only checked between levels.
+     * Pass an empty function to go back to the serial search.
+     *
+     * @since 1.1.16
+     */
+    void setParallelFor(ParallelFor parallelFor);
+
     bool decode(Lattice &lattice, const SegmentGraph &graph, size_t nbest,
                 const State &state,
                 float max = std::numeric_limits<float>::max(),
@@ -43,6 +179,29 @@ public:
                 size_t beamSize = beamSizeDefault,
                 size_t frameSize = frameSizeDefault,
                 void *helper = nullptr) const;
+    /**
+     * Decode with the extra options, see DecodeOptions.
+     *
+     * @since 1.1.16
+     */
+    bool decode(Lattice &lattice, const SegmentGraph &graph, size_t nbest,
+                const State &state, float max, float min, size_t beamSize,
+                size_t frameSize, void *helper,
+                const DecodeOptions &options) const;
+
+    /**
+     * Find more sentences of the lattice.
+     *
+     * The backward search of the last decode is kept in the lattice, this
+     * continues it to append up to count more distinct sentences. The
+     * lattice must be decoded by this decoder, and not changed since then.
+     *
+     * @param lattice lattice of the last decode
+     * @param count number of sentences to find
+     * @return number of sentences found, 0 if there is no more.
+     * @since 1.1.16
+     */
+    size_t nextSentences(Lattice &lattice, size_t count) const;
 
 protected:
     LatticeNode *
@@ -54,6 +213,8 @@ protected:
         return createLatticeNodeImpl(graph, model, word, idx, std::move(path),
                                      state, cost, std::move(data), onlyPath);
     }
+    // LatticeNode and LatticeNodeData created with new here are allocated
+    // from the arena of the lattice, see LatticeNode::operator new.
     virtual LatticeNode *createLatticeNodeImpl(
         const SegmentGraphBase &graph, const LanguageModelBase *model,
         std::string_view word, WordIndex idx, SegmentGraphPath path,
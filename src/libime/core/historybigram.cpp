@@ -17,6 +17,7 @@
 #include <memory>
 #include <ostream>
 #include <ranges>
+#include <span>
 #include <stdexcept>
 #include <string>
 #include <string_view>
@@ -223,23 +224,22 @@ public:
 
     void fillPredict(std::unordered_set<std::string> &words,
                      std::string_view word, size_t maxSize) const {
-        trie_.foreach(word,
-                      [this, &words, maxSize](TrieType::value_type, size_t len,
-                                              TrieType::position_type pos) {
-                          std::string buf;
-                          trie().suffix(buf, len, pos);
-                          auto separatorPos = buf.find(wordCodeSeparator);
-                          if (separatorPos != std::string::npos) {
-                              buf.erase(separatorPos);
-                          }
-                          // Skip special word.
-                          if (buf == "<s>" || buf == "</s>") {
-                              return true;
-                          }
-                          words.emplace(std::move(buf));
-
-                          return maxSize <= 0 || words.size() < maxSize;
-                      });
+        trie_.foreachKey(word, [&word, &words, maxSize](
+                                   TrieType::value_type, std::string_view key,
+                                   TrieType::position_type) {
+            auto buf = key.substr(word.size());
+            auto separatorPos = buf.find(wordCodeSeparator);
+            if (separatorPos != std::string_view::npos) {
+                buf = buf.substr(0, separatorPos);
+            }
+            // Skip special word.
+            if (buf == "<s>" || buf == "</s>") {
+                return true;
+            }
+            words.emplace(buf);
+
+            return maxSize <= 0 || words.size() < maxSize;
+        });
     }
 
 private:
@@ -564,6 +564,39 @@ public:
         return size;
     }
 
+    // The part of probability that only depends on cur.
+    float unigramProbability(WordWithCodeView cur) const {
+        const float bigramWeight = useOnlyUnigram_ ? 0.0F : 0.8F;
+        const float unigramWeight = 1.0F - bigramWeight;
+        const float poolWeightHalf = poolWeight_[0] / 2.0F;
+
+        // add 0.5 to avoid div 0
+        return unigramWeight * unigramFreq(cur) /
+               (unigramSize() + poolWeightHalf);
+    }
+
+    float score(WordWithCodeView prev, WordWithCodeView cur,
+                float unigramPr) const {
+        if (prev.first.empty()) {
+            prev.first = "<s>";
+        }
+        const float bigramWeight = 0.8F;
+        const float poolWeightHalf = poolWeight_[0] / 2.0F;
+
+        float pr = unigramPr;
+        if (!useOnlyUnigram_) {
+            pr += bigramWeight * bigramFreq(prev, cur) /
+                  (unigramFreq(prev) + poolWeightHalf);
+        }
+
+        pr = std::min<float>(pr, 1.0F);
+        if (pr == 0) {
+            return unknown_;
+        }
+
+        return std::log10(pr);
+    }
+
     // A log probabilty.
     float unknown_ =
         std::log10(DEFAULT_LANGUAGE_MODEL_UNKNOWN_PROBABILITY_PENALTY);
@@ -660,31 +693,10 @@ float HistoryBigram::score(std::string_view prev, std::string_view cur) const {
 float HistoryBigram::scoreWithCode(WordWithCodeView prev,
                                    WordWithCodeView cur) const {
     FCITX_D();
-    if (prev.first.empty()) {
-        prev.first = "<s>";
-    }
     if (cur.first.empty()) {
         cur.first = "<unk>";
     }
-
-    const float bigramWeight = d->useOnlyUnigram_ ? 0.0F : 0.8F;
-    const float unigramWeight = 1.0F - bigramWeight;
-    const float poolWeightHalf = d->poolWeight_[0] / 2.0F;
-
-    // add 0.5 to avoid div 0
-    float pr = unigramWeight * d->unigramFreq(cur) /
-               (d->unigramSize() + poolWeightHalf);
-    if (!d->useOnlyUnigram_) {
-        pr += bigramWeight * d->bigramFreq(prev, cur) /
-              (d->unigramFreq(prev) + poolWeightHalf);
-    }
-
-    pr = std::min<float>(pr, 1.0F);
-    if (pr == 0) {
-        return d->unknown_;
-    }
-
-    return std::log10(pr);
+    return d->score(prev, cur, d->unigramProbability(cur));
 }
 
 void HistoryBigram::load(std::istream &in) {
@@ -826,6 +838,37 @@ float HistoryBigram::scoreWithCode(
         {cur ? cur->word() : "", extractor && cur ? extractor(cur) : ""});
 }
 
+void HistoryBigram::scoreWithCodeBatch(
+    std::span<const WordNode *const> prevs, const WordNode *cur,
+    const ValidationCodeExtractor &extractor, std::span<float> scores) const {
+    FCITX_D();
+    if (prevs.size() != scores.size()) {
+        throw std::invalid_argument("prevs and scores size mismatch");
+    }
+    std::string curCode;
+    if (extractor && cur) {
+        curCode = extractor(cur);
+    }
+    WordWithCodeView curView{"<unk>", curCode};
+    if (cur && !cur->word().empty()) {
+        curView.first = cur->word();
+    }
+    const float unigramPr = d->unigramProbability(curView);
+    std::string prevCode;
+    for (size_t i = 0; i < prevs.size(); i++) {
+        const auto *prev = prevs[i];
+        WordWithCodeView prevView;
+        if (prev) {
+            if (extractor) {
+                prevCode = extractor(prev);
+                prevView.second = prevCode;
+            }
+            prevView.first = prev->word();
+        }
+        scores[i] = d->score(prevView, curView, unigramPr);
+    }
+}
+
 void HistoryBigram::addWithContext(const std::vector<WordWithCode> &context,
                                    std::vector<WordWithCode> newSentence) {
     FCITX_D();
@@ -12,6 +12,7 @@
 #include <istream>
 #include <memory>
 #include <ostream>
+#include <span>
 #include <string>
 #include <string_view>
 #include <unordered_set>
@@ -102,6 +103,19 @@ public:
     int32_t rawBigramFrequency(WordWithCodeView prev,
                                WordWithCodeView cur) const;
 
+    /**
+     * Score cur after each of prevs, the same as calling scoreWithCode for
+     * each of them, but the part that only depends on cur is computed once.
+     *
+     * @param prevs previous words, nullptr means the sentence begin.
+     * @param scores output, must have the same size as prevs.
+     * @since 1.1.16
+     */
+    void scoreWithCodeBatch(std::span<const WordNode *const> prevs,
+                            const WordNode *cur,
+                            const ValidationCodeExtractor &extractor,
+                            std::span<float> scores) const;
+
     void addWithContext(const std::vector<WordWithCode> &context,
                         std::vector<WordWithCode> newSentence);
 
@@ -5,13 +5,27 @@
  */
 
 #include "languagemodel.h"
+#if __has_include(<sys/mman.h>)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define LIBIME_LANGUAGEMODEL_HAS_MMAP
+#endif
 #include <algorithm>
+#include <bit>
+#include <chrono>
 #include <cassert>
 #include <cmath>
+#include <cstddef>
 #include <cstdlib>
+#include <exception>
 #include <fstream>
 #include <ios>
+#include <future>
 #include <memory>
+#include <mutex>
+#include <span>
 #include <string>
 #include <string_view>
 #include <type_traits>
@@ -24,6 +38,7 @@
 #include "config.h"
 #include "constants.h"
 #include "datrie.h"
+#include "languagemodel_p.h"
 #include "lattice.h"
 #include "lm/config.hh"
 #include "lm/lm_exception.hh"
@@ -31,48 +46,190 @@
 #include "lm/return.hh"
 #include "lm/state.hh"
 #include "lm/word_index.hh"
+#include "util/mmap.hh"
 #include "util/string_piece.hh"
 #include "utils.h"
 
 namespace libime {
 
+namespace {
+
+util::LoadMethod kenlmLoadMethod(LanguageModelLoadMethod method) {
+    switch (method) {
+    case LanguageModelLoadMethod::Lazy:
+        return util::LAZY;
+    case LanguageModelLoadMethod::Populate:
+        break;
+    case LanguageModelLoadMethod::Read:
+        return util::READ;
+    case LanguageModelLoadMethod::ParallelRead:
+        return util::PARALLEL_READ;
+    }
+    return util::POPULATE_OR_READ;
+}
+
+#ifdef LIBIME_LANGUAGEMODEL_HAS_MMAP
+// Map the model file to check or advise its pages. The pages in page cache
+// are shared with the mapping of kenlm.
+template <typename Callback>
+void mapModelFile(const std::string &file, Callback callback) {
+    const int fd = ::open(file.data(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+    struct stat st;
+    void *addr = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        addr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    ::close(fd);
+    if (addr == MAP_FAILED) {
+        return;
+    }
+    callback(addr, static_cast<size_t>(st.st_size));
+    munmap(addr, st.st_size);
+}
+#endif
+
+DATrie<float> loadPredictionTrie(const std::string &file) {
+    DATrie<float> trie;
+    try {
+        std::ifstream fin;
+        fin.open(file + ".predict", std::ios::in | std::ios::binary);
+        if (fin) {
+            trie.load(fin);
+        }
+    } catch (...) {
+        trie.clear();
+    }
+    return trie;
+}
+
+} // namespace
+
 class StaticLanguageModelFilePrivate {
 public:
     StaticLanguageModelFilePrivate(const char *file,
-                                   const lm::ngram::Config &config)
-        : model_(file, config), file_(file) {}
+                                   const lm::ngram::Config &config,
+                                   const LanguageModelLoadOptions &options)
+        : model_(file, config), file_(file), options_(options) {
+        // Computed with the model, so the first decode doesn't pay for it.
+        // With Lazy, it would touch every page of the unigram part of file.
+        if (options_.method != LanguageModelLoadMethod::Lazy) {
+            unigramScores();
+        }
+    }
     lm::ngram::QuantArrayTrieModel model_;
     std::string file_;
-    mutable bool predictionLoaded_ = false;
+    LanguageModelLoadOptions options_;
+    mutable std::once_flag predictionLoaded_;
     mutable DATrie<float> prediction_;
+    mutable std::once_flag predictionIndexLoaded_;
+    mutable DATrie<float> predictionIndex_;
+    mutable std::once_flag unigramLoaded_;
+    mutable std::vector<float> unigram_;
+
+    std::span<const float> unigramScores() const {
+        // Other threads calling this wait until the table is built.
+        std::call_once(unigramLoaded_, [this]() {
+            const auto state = model_.NullContextState();
+            lm::ngram::State out;
+            unigram_.resize(model_.GetVocabulary().Bound());
+            for (WordIndex idx = 0; idx < unigram_.size(); idx++) {
+                unigram_[idx] = model_.Score(state, idx, out);
+            }
+        });
+        return unigram_;
+    }
 };
 
-StaticLanguageModelFile::StaticLanguageModelFile(const char *file) {
+StaticLanguageModelFile::StaticLanguageModelFile(const char *file)
+    : StaticLanguageModelFile(file, LanguageModelLoadOptions()) {}
+
+StaticLanguageModelFile::StaticLanguageModelFile(
+    const char *file, const LanguageModelLoadOptions &options) {
+#ifdef LIBIME_LANGUAGEMODEL_HAS_MMAP
+    if (options.willNeed) {
+        mapModelFile(file, [](void *addr, size_t length) {
+            madvise(addr, length, MADV_WILLNEED);
+        });
+    }
+#endif
     lm::ngram::Config config;
     config.sentence_marker_missing = lm::SILENT;
-    d_ptr = std::make_unique<StaticLanguageModelFilePrivate>(file, config);
+    config.load_method = kenlmLoadMethod(options.method);
+    d_ptr = std::make_unique<StaticLanguageModelFilePrivate>(file, config,
+                                                             options);
 }
 
 StaticLanguageModelFile::~StaticLanguageModelFile() {}
 
-const DATrie<float> &StaticLanguageModelFile::predictionTrie() const {
+const LanguageModelLoadOptions &StaticLanguageModelFile::loadOptions() const {
+    FCITX_D();
+    return d->options_;
+}
+
+size_t StaticLanguageModelFile::fileSize() const {
+    FCITX_D();
+#ifdef LIBIME_LANGUAGEMODEL_HAS_MMAP
+    struct stat st;
+    if (stat(d->file_.data(), &st) == 0 && st.st_size > 0) {
+        return st.st_size;
+    }
+#endif
+    return 0;
+}
+
+size_t StaticLanguageModelFile::residentSize() const {
     FCITX_D();
-    if (!d->predictionLoaded_) {
-        d->predictionLoaded_ = true;
-        try {
-            std::ifstream fin;
-            fin.open(d->file_ + ".predict", std::ios::in | std::ios::binary);
-            if (fin) {
-                DATrie<float> trie;
-                trie.load(fin);
-                d->prediction_ = std::move(trie);
+    if (d->options_.method == LanguageModelLoadMethod::Read ||
+        d->options_.method == LanguageModelLoadMethod::ParallelRead) {
+        return fileSize();
+    }
+    size_t resident = 0;
+#ifdef LIBIME_LANGUAGEMODEL_HAS_MMAP
+    mapModelFile(d->file_, [&resident](void *addr, size_t length) {
+        const auto pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#ifdef __APPLE__
+        std::vector<char> pages((length + pageSize - 1) / pageSize);
+#else
+        std::vector<unsigned char> pages((length + pageSize - 1) / pageSize);
+#endif
+        if (mincore(addr, length, pages.data()) != 0) {
+            return;
+        }
+        for (auto page : pages) {
+            if (page & 1) {
+                resident += pageSize;
             }
-        } catch (...) {
         }
-    }
+        resident = std::min(resident, length);
+    });
+#endif
+    return resident;
+}
+
+const DATrie<float> &StaticLanguageModelFile::predictionTrie() const {
+    FCITX_D();
+    // Other threads calling this wait until the trie is loaded.
+    std::call_once(d->predictionLoaded_, [d]() {
+        d->prediction_ = loadPredictionTrie(d->file_);
+    });
     return d->prediction_;
 }
 
+const DATrie<float> &StaticLanguageModelFile::predictionIndex() const {
+    FCITX_D();
+    std::call_once(d->predictionIndexLoaded_, [d]() {
+        auto trie = loadPredictionTrie(d->file_);
+        // Only the order of prediction matters.
+        trie.quantize(16);
+        trie.buildTopKIndex();
+        d->predictionIndex_ = std::move(trie);
+    });
+    return d->predictionIndex_;
+}
+
 static_assert(sizeof(void *) + sizeof(lm::ngram::State) <= StateSize, "Size");
 
 LanguageModelBase::~LanguageModelBase() {}
@@ -81,6 +238,21 @@ bool LanguageModelBase::isNodeUnknown(const LatticeNode &node) const {
     return isUnknown(node.idx(), node.word());
 }
 
+void LanguageModelBase::scoreBatch(std::span<const State *const> states,
+                                   const WordNode &word,
+                                   std::span<float> scores,
+                                   std::span<State> outs) const {
+    assert(states.size() == scores.size() && states.size() == outs.size());
+    for (size_t i = 0; i < states.size(); i++) {
+        scores[i] = score(*states[i], word, outs[i]);
+    }
+}
+
+float LanguageModelBase::unigramScore(const WordNode &word) const {
+    State dummy;
+    return score(nullState(), word, dummy);
+}
+
 float LanguageModelBase::singleWordScore(std::string_view word) const {
     auto idx = index(word);
     State dummy;
@@ -121,6 +293,105 @@ static inline const lm::ngram::State &lmState(const State &state) {
     return *reinterpret_cast<const lm::ngram::State *>(state.data());
 }
 
+class LanguageModelCachePrivate {
+public:
+    struct Entry {
+        lm::ngram::State state;
+        WordIndex idx = InvalidWordIndex;
+        float score = 0;
+        lm::ngram::State out;
+    };
+
+    LanguageModelCachePrivate(size_t capacity) : capacity_(capacity) {}
+
+    float score(const std::shared_ptr<const StaticLanguageModelFile> &file,
+                const lm::ngram::QuantArrayTrieModel *model,
+                const lm::ngram::State &state, WordIndex idx,
+                lm::ngram::State &out) {
+        if (idx == InvalidWordIndex) {
+            return model->Score(state, idx, out);
+        }
+        // The weak_ptr keeps the control block alive, so it can't be taken
+        // by another file.
+        if (file_.owner_before(file) || file.owner_before(file_)) {
+            clear();
+            file_ = file;
+        }
+        // Allocate on first use.
+        if (entries_.empty()) {
+            entries_.resize(capacity_);
+        }
+        auto &entry = entries_[hash_value(state, idx) & (capacity_ - 1)];
+        if (entry.idx != idx || !(entry.state == state)) {
+            entry.state = state;
+            entry.idx = idx;
+            entry.score = model->Score(state, idx, entry.out);
+            ++misses_;
+        } else {
+            ++hits_;
+        }
+        out = entry.out;
+        return entry.score;
+    }
+
+    void clear() {
+        for (auto &entry : entries_) {
+            entry.idx = InvalidWordIndex;
+        }
+    }
+
+    size_t capacity_;
+    std::weak_ptr<const StaticLanguageModelFile> file_;
+    std::vector<Entry> entries_;
+    size_t hits_ = 0;
+    size_t misses_ = 0;
+};
+
+namespace {
+
+thread_local LanguageModelCache *currentCache = nullptr;
+
+} // namespace
+
+LanguageModelCacheScope::LanguageModelCacheScope(LanguageModelCache *cache)
+    : previous_(currentCache) {
+    currentCache = cache;
+}
+
+LanguageModelCacheScope::~LanguageModelCacheScope() {
+    currentCache = previous_;
+}
+
+LanguageModelCache *LanguageModelCacheScope::current() {
+    return currentCache;
+}
+
+LanguageModelCache::LanguageModelCache(size_t capacity)
+    : d_ptr(std::make_unique<LanguageModelCachePrivate>(
+          std::bit_ceil(std::max<size_t>(capacity, 1)))) {}
+
+FCITX_DEFINE_DEFAULT_DTOR_AND_MOVE(LanguageModelCache)
+
+size_t LanguageModelCache::capacity() const {
+    FCITX_D();
+    return d->capacity_;
+}
+
+void LanguageModelCache::clear() {
+    FCITX_D();
+    d->clear();
+}
+
+size_t LanguageModelCache::hits() const {
+    FCITX_D();
+    return d->hits_;
+}
+
+size_t LanguageModelCache::misses() const {
+    FCITX_D();
+    return d->misses_;
+}
+
 class LanguageModelPrivate {
 public:
     LanguageModelPrivate(std::shared_ptr<const StaticLanguageModelFile> file)
@@ -130,6 +401,12 @@ public:
     const auto *model() const {
         return file_ ? &file_->d_func()->model_ : nullptr;
     }
+    std::span<const float> unigramScores() const {
+        if (!file_) {
+            return {};
+        }
+        return file_->d_func()->unigramScores();
+    }
 
     std::shared_ptr<const StaticLanguageModelFile> file_;
     State beginState_;
@@ -214,14 +491,64 @@ float LanguageModel::score(const State &state, const WordNode &node,
     if (!d->model()) {
         return d->unknown_;
     }
+    const float penalty = node.idx() == unknown() ? d->unknown_ : 0.0F;
+    if (auto *cache = LanguageModelCacheScope::current()) {
+        return cache->d_func()->score(d->file_, d->model(), lmState(state),
+                                      node.idx(), lmState(out)) +
+               penalty;
+    }
     return d->model()->Score(lmState(state), node.idx(), lmState(out)) +
-           (node.idx() == unknown() ? d->unknown_ : 0.0F);
+           penalty;
+}
+
+void LanguageModel::scoreBatch(std::span<const State *const> states,
+                               const WordNode &node, std::span<float> scores,
+                               std::span<State> outs) const {
+    FCITX_D();
+    assert(states.size() == scores.size() && states.size() == outs.size());
+    const auto *model = d->model();
+    if (!model) {
+        std::ranges::fill(scores, d->unknown_);
+        return;
+    }
+    const auto idx = node.idx();
+    const float penalty = idx == unknown() ? d->unknown_ : 0.0F;
+    if (auto *cache = LanguageModelCacheScope::current()) {
+        auto *c = cache->d_func();
+        for (size_t i = 0; i < states.size(); i++) {
+            assert(states[i] != &outs[i]);
+            scores[i] = c->score(d->file_, model, lmState(*states[i]), idx,
+                                 lmState(outs[i])) +
+                        penalty;
+        }
+        return;
+    }
+    for (size_t i = 0; i < states.size(); i++) {
+        assert(states[i] != &outs[i]);
+        scores[i] =
+            model->Score(lmState(*states[i]), idx, lmState(outs[i])) + penalty;
+    }
 }
 
 bool LanguageModel::isUnknown(WordIndex idx, std::string_view /*word*/) const {
     return idx == unknown();
 }
 
+float LanguageModel::unigramScore(const WordNode &node) const {
+    FCITX_D();
+    const auto scores = d->unigramScores();
+    if (node.idx() >= scores.size()) {
+        return LanguageModelBase::unigramScore(node);
+    }
+    const float penalty = node.idx() == unknown() ? d->unknown_ : 0.0F;
+    return scores[node.idx()] + penalty;
+}
+
+std::span<const float> LanguageModel::unigramScores() const {
+    FCITX_D();
+    return d->unigramScores();
+}
+
 unsigned int
 LanguageModel::maxNgramLength(const std::vector<std::string> &words) const {
     FCITX_D();
@@ -260,9 +587,46 @@ float LanguageModel::unknownPenalty() const {
 
 class LanguageModelResolverPrivate {
 public:
+    // Return the loaded file of language, mutex_ must be locked.
+    std::shared_ptr<const StaticLanguageModelFile>
+    findFile(const std::string &language) {
+        std::shared_ptr<const StaticLanguageModelFile> file;
+        // Move the finished load to files_.
+        if (auto iter = loading_.find(language);
+            iter != loading_.end() &&
+            iter->second.wait_for(std::chrono::seconds(0)) ==
+                std::future_status::ready) {
+            try {
+                file = iter->second.get();
+            } catch (...) {
+                // Load again, so the error is thrown to the caller.
+            }
+            loading_.erase(iter);
+            if (file) {
+                files_[language] = file;
+                return file;
+            }
+        }
+        auto iter = files_.find(language);
+        if (iter != files_.end()) {
+            file = iter->second.lock();
+            if (file) {
+                return file;
+            }
+            files_.erase(iter);
+        }
+        return nullptr;
+    }
+
+    mutable std::mutex mutex_;
     std::unordered_map<std::string,
                        std::weak_ptr<const StaticLanguageModelFile>>
         files_;
+    std::unordered_map<std::string, LanguageModelResolver::FileFuture>
+        loading_;
+    std::unordered_map<std::string, LanguageModelResolver::FileFuture>
+        preloaded_;
+    LanguageModelLoadOptions options_;
 };
 
 LanguageModelResolver::LanguageModelResolver()
@@ -274,14 +638,14 @@ std::shared_ptr<const StaticLanguageModelFile>
 LanguageModelResolver::languageModelFileForLanguage(
     const std::string &language) {
     FCITX_D();
-    auto iter = d->files_.find(language);
-    std::shared_ptr<const StaticLanguageModelFile> file;
-    if (iter != d->files_.end()) {
-        file = iter->second.lock();
-        if (file) {
-            return file;
-        }
-        d->files_.erase(iter);
+    std::unique_lock lock(d->mutex_);
+    if (auto file = d->findFile(language)) {
+        return file;
+    }
+    if (auto iter = d->loading_.find(language); iter != d->loading_.end()) {
+        auto future = iter->second;
+        lock.unlock();
+        return future.get();
     }
 
     auto fileName = languageModelFileNameForLanguage(language);
@@ -289,11 +653,88 @@ LanguageModelResolver::languageModelFileForLanguage(
         return nullptr;
     }
 
-    file = std::make_shared<StaticLanguageModelFile>(fileName.data());
-    d->files_.emplace(language, file);
+    // Register the load like the async one, so it is done without the lock
+    // and other threads loading the same language wait for it.
+    std::promise<std::shared_ptr<const StaticLanguageModelFile>> promise;
+    d->loading_.emplace(language, promise.get_future().share());
+    const auto options = d->options_;
+    lock.unlock();
+
+    std::shared_ptr<const StaticLanguageModelFile> file;
+    std::exception_ptr error;
+    try {
+        file =
+            std::make_shared<StaticLanguageModelFile>(fileName.data(), options);
+        promise.set_value(file);
+    } catch (...) {
+        error = std::current_exception();
+        promise.set_exception(error);
+    }
+    lock.lock();
+    // Move the finished load to files_, or drop the failed one.
+    d->findFile(language);
+    lock.unlock();
+    if (error) {
+        std::rethrow_exception(error);
+    }
     return file;
 }
 
+LanguageModelResolver::FileFuture
+LanguageModelResolver::languageModelFileForLanguageAsync(
+    const std::string &language) {
+    FCITX_D();
+    std::lock_guard lock(d->mutex_);
+    auto file = d->findFile(language);
+    if (auto iter = d->loading_.find(language);
+        !file && iter != d->loading_.end()) {
+        return iter->second;
+    }
+    std::string fileName;
+    if (!file) {
+        fileName = languageModelFileNameForLanguage(language);
+    }
+    if (file || fileName.empty()) {
+        std::promise<std::shared_ptr<const StaticLanguageModelFile>> promise;
+        promise.set_value(std::move(file));
+        return promise.get_future().share();
+    }
+
+    FileFuture future =
+        std::async(std::launch::async,
+                   [fileName = std::move(fileName), options = d->options_]()
+                       -> std::shared_ptr<const StaticLanguageModelFile> {
+                       return std::make_shared<StaticLanguageModelFile>(
+                           fileName.data(), options);
+                   })
+            .share();
+    d->loading_.emplace(language, future);
+    return future;
+}
+
+void LanguageModelResolver::preloadLanguages(
+    const std::vector<std::string> &languages) {
+    FCITX_D();
+    for (const auto &language : languages) {
+        auto future = languageModelFileForLanguageAsync(language);
+        std::lock_guard lock(d->mutex_);
+        d->preloaded_.insert_or_assign(language, std::move(future));
+    }
+}
+
+void LanguageModelResolver::setLoadOptions(
+    const LanguageModelLoadOptions &options) {
+    FCITX_D();
+    std::lock_guard lock(d->mutex_);
+    d->options_ = options;
+}
+
+LanguageModelLoadOptions LanguageModelResolver::loadOptions() const {
+    FCITX_D();
+    std::lock_guard lock(d->mutex_);
+    return d->options_;
+}
+
 DefaultLanguageModelResolver::DefaultLanguageModelResolver() = default;
 DefaultLanguageModelResolver::~DefaultLanguageModelResolver() = default;
 
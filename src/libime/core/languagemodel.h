@@ -8,8 +8,10 @@
 
 #include <array>
 #include <cstddef>
+#include <future>
 #include <limits>
 #include <memory>
+#include <span>
 #include <string>
 #include <string_view>
 #include <vector>
@@ -28,6 +30,7 @@ using State = std::array<char, StateSize>;
 class WordNode;
 class LatticeNode;
 class LanguageModelPrivate;
+class LanguageModelCachePrivate;
 class LanguageModelResolverPrivate;
 
 class LIBIMECORE_EXPORT LanguageModelBase {
@@ -43,6 +46,26 @@ public:
     virtual float score(const State &state, const WordNode &word,
                         State &out) const = 0;
     virtual bool isUnknown(WordIndex idx, std::string_view view) const = 0;
+    /**
+     * Score word after each of states, the same as calling score for each
+     * of them. Implementation may share the work that only depends on word.
+     *
+     * scores and outs must have the same size as states.
+     *
+     * @since 1.1.16
+     */
+    virtual void scoreBatch(std::span<const State *const> states,
+                            const WordNode &word, std::span<float> scores,
+                            std::span<State> outs) const;
+    /**
+     * Score of word without context, the same as score after nullState.
+     *
+     * Implementation may make it faster than score, it is used to rank the
+     * words when only an approximate order is needed.
+     *
+     * @since 1.1.16
+     */
+    virtual float unigramScore(const WordNode &word) const;
     bool isNodeUnknown(const LatticeNode &node) const;
     float singleWordScore(std::string_view word) const;
     float singleWordScore(const State &state, std::string_view word) const;
@@ -52,20 +75,150 @@ public:
 
 class StaticLanguageModelFilePrivate;
 
+/**
+ * How the model file is loaded into memory.
+ *
+ * @since 1.1.16
+ */
+enum class LanguageModelLoadMethod {
+    /**
+     * Map the file, and only read the pages when they are used. All processes
+     * loading the same file share one copy in the page cache.
+     */
+    Lazy,
+    /**
+     * Map the file and read all of it when loading, or read it into memory
+     * if that is not supported. This is the default.
+     */
+    Populate,
+    /// Read the file into memory of this process.
+    Read,
+    /// The same as Read, but with multiple threads.
+    ParallelRead,
+};
+
+/**
+ * Options to load StaticLanguageModelFile.
+ *
+ * @since 1.1.16
+ */
+struct LanguageModelLoadOptions {
+    /**
+     * How the file is loaded.
+     *
+     * Except for Lazy, the table of unigram scores is also computed when
+     * loading, which reads the unigram part of the file and takes 4 bytes per
+     * word of memory. With Lazy, it is computed on the first use instead.
+     */
+    LanguageModelLoadMethod method = LanguageModelLoadMethod::Populate;
+    /**
+     * Advise the kernel to read the file into page cache in background before
+     * loading (madvise MADV_WILLNEED), mostly useful with Lazy to make the
+     * first use faster without blocking the load.
+     */
+    bool willNeed = false;
+};
+
+/**
+ * The language model data loaded from file.
+ *
+ * It is read only after it is loaded, so one file can be shared by the
+ * language models used by multiple threads.
+ */
 class LIBIMECORE_EXPORT StaticLanguageModelFile {
     friend class LanguageModelPrivate;
+    friend class Prediction;
 
 public:
     explicit StaticLanguageModelFile(const char *file);
+    /**
+     * Load the model file with options.
+     *
+     * @since 1.1.16
+     */
+    StaticLanguageModelFile(const char *file,
+                            const LanguageModelLoadOptions &options);
     virtual ~StaticLanguageModelFile();
 
+    /**
+     * The prediction data in the file with .predict suffix.
+     *
+     * It is loaded on the first call, which is safe to be called from
+     * multiple threads. The values are kept as they are in the file.
+     */
     const DATrie<float> &predictionTrie() const;
 
+    /**
+     * Options used to load this file.
+     *
+     * @since 1.1.16
+     */
+    const LanguageModelLoadOptions &loadOptions() const;
+
+    /**
+     * Size of the model file in bytes, 0 if it can not be checked.
+     *
+     * @since 1.1.16
+     */
+    size_t fileSize() const;
+
+    /**
+     * Bytes of the model that are in memory.
+     *
+     * For Lazy and Populate, this is the part of the file in the page cache,
+     * which can be evicted and read again when memory is low. For Read and
+     * ParallelRead, the whole file is copied into memory, so it is the same
+     * as fileSize.
+     *
+     * @since 1.1.16
+     */
+    size_t residentSize() const;
+
 private:
+    // Quantized copy of predictionTrie with topK index, used by Prediction.
+    const DATrie<float> &predictionIndex() const;
+
     std::unique_ptr<StaticLanguageModelFilePrivate> d_ptr;
     FCITX_DECLARE_PRIVATE(StaticLanguageModelFile);
 };
 
+/**
+ * A cache of the n-gram scores computed by LanguageModel.
+ *
+ * The cache is owned by the caller and passed to Decoder::decode, so the
+ * scores of the same context and word can be reused by the following decode
+ * of a growing input. Only the n-gram part of the score is cached, which
+ * doesn't depend on the user history, so it stays valid when the history
+ * changes. The cache is cleared when it is used by a different model.
+ *
+ * It is a fixed size hash table where a new entry replaces the old one with
+ * the same hash, so it never grows beyond the capacity.
+ *
+ * @since 1.1.16
+ */
+class LIBIMECORE_EXPORT LanguageModelCache {
+    friend class LanguageModel;
+
+public:
+    static constexpr size_t defaultCapacity = 16384;
+
+    /// Capacity is rounded up to the power of 2.
+    explicit LanguageModelCache(size_t capacity = defaultCapacity);
+    FCITX_DECLARE_VIRTUAL_DTOR_MOVE(LanguageModelCache);
+
+    size_t capacity() const;
+    void clear();
+
+    /// Number of scores found in the cache since it is created.
+    size_t hits() const;
+    /// Number of scores not found in the cache since it is created.
+    size_t misses() const;
+
+private:
+    std::unique_ptr<LanguageModelCachePrivate> d_ptr;
+    FCITX_DECLARE_PRIVATE(LanguageModelCache);
+};
+
 class LIBIMECORE_EXPORT LanguageModel : public LanguageModelBase {
 public:
     explicit LanguageModel(const char *file);
@@ -85,7 +238,28 @@ public:
     WordIndex index(std::string_view word) const override;
     float score(const State &state, const WordNode &node,
                 State &out) const override;
+    void scoreBatch(std::span<const State *const> states, const WordNode &node,
+                    std::span<float> scores,
+                    std::span<State> outs) const override;
     bool isUnknown(WordIndex idx, std::string_view word) const override;
+    /**
+     * Read the score from unigramScores, unknownPenalty is added to unknown
+     * word.
+     *
+     * @since 1.1.16
+     */
+    float unigramScore(const WordNode &node) const override;
+    /**
+     * The scores of words without context, indexed by WordIndex.
+     *
+     * It doesn't include unknownPenalty. The table is computed when the file
+     * is loaded, or on the first call with LanguageModelLoadMethod::Lazy, and
+     * shared by all language models using the same file. Empty if there is no
+     * file.
+     *
+     * @since 1.1.16
+     */
+    std::span<const float> unigramScores() const;
     void setUnknownPenalty(float unknown);
     float unknownPenalty() const;
 
@@ -100,13 +274,66 @@ private:
 ///
 /// The resolver will also hold a weak reference to the language model file.
 /// If the language model file is still alive no new file will be constructed.
+///
+/// The resolver may be used from multiple threads.
 class LIBIMECORE_EXPORT LanguageModelResolver {
 public:
+    /**
+     * Language model file being loaded, nullptr if there is no file for the
+     * language.
+     *
+     * @since 1.1.16
+     */
+    using FileFuture =
+        std::shared_future<std::shared_ptr<const StaticLanguageModelFile>>;
+
     LanguageModelResolver();
     FCITX_DECLARE_VIRTUAL_DTOR_MOVE(LanguageModelResolver)
+    /**
+     * Return the language model file, load it if it is not loaded.
+     *
+     * If the file is being loaded by languageModelFileForLanguageAsync or
+     * another thread, wait for it. The file is loaded without blocking the
+     * lookups of other languages.
+     */
     std::shared_ptr<const StaticLanguageModelFile>
     languageModelFileForLanguage(const std::string &language);
 
+    /**
+     * Load the language model file on a new thread.
+     *
+     * The caller may keep using a fallback, like a LanguageModel without
+     * file, until the future is ready. Errors in loading are thrown by
+     * the future.
+     *
+     * @since 1.1.16
+     */
+    FileFuture languageModelFileForLanguageAsync(const std::string &language);
+
+    /**
+     * Load the language model files of languages in background.
+     *
+     * The resolver keeps the preloaded files, so they are not unloaded when
+     * no language model uses them.
+     *
+     * @since 1.1.16
+     */
+    void preloadLanguages(const std::vector<std::string> &languages);
+
+    /**
+     * Options to load new language model files.
+     *
+     * Files that are already loaded and still alive are not reloaded.
+     *
+     * @since 1.1.16
+     */
+    void setLoadOptions(const LanguageModelLoadOptions &options);
+    /**
+     * @see setLoadOptions
+     * @since 1.1.16
+     */
+    LanguageModelLoadOptions loadOptions() const;
+
 protected:
     virtual std::string
     languageModelFileNameForLanguage(const std::string &language) = 0;
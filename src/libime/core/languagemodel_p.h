@@ -0,0 +1,30 @@
+/*
+ * SPDX-FileCopyrightText: 2017-2017 CSSlayer <wengxt@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+#ifndef _FCITX_LIBIME_CORE_LANGUAGEMODEL_P_H_
+#define _FCITX_LIBIME_CORE_LANGUAGEMODEL_P_H_
+
+#include <libime/core/languagemodel.h>
+
+namespace libime {
+
+// LanguageModel in current thread uses the cache until the scope ends.
+class LanguageModelCacheScope {
+public:
+    explicit LanguageModelCacheScope(LanguageModelCache *cache);
+    ~LanguageModelCacheScope();
+    LanguageModelCacheScope(const LanguageModelCacheScope &) = delete;
+    LanguageModelCacheScope &
+    operator=(const LanguageModelCacheScope &) = delete;
+
+    static LanguageModelCache *current();
+
+private:
+    LanguageModelCache *previous_;
+};
+
+} // namespace libime
+
+#endif // _FCITX_LIBIME_CORE_LANGUAGEMODEL_P_H_
@@ -5,8 +5,11 @@
  */
 
 #include "lattice.h"
+#include <algorithm>
 #include <cstddef>
+#include <cstring>
 #include <memory>
+#include <new>
 #include <string>
 #include <type_traits>
 #include <unordered_set>
@@ -16,6 +19,102 @@
 
 namespace libime {
 
+namespace {
+
+thread_local LatticeArena *currentArena = nullptr;
+
+} // namespace
+
+void *LatticeArena::allocate(size_t size) {
+    const size_t blockSize =
+        (size + headerSize + alignment - 1) / alignment * alignment;
+    void *block;
+    LatticeArena *arena = currentArena;
+    if (arena && blockSize <= maxBlockSize) {
+        block = arena->allocateBlock(blockSize);
+    } else {
+        arena = nullptr;
+        block = ::operator new(blockSize);
+    }
+    std::memcpy(block, &arena, sizeof(arena));
+    return static_cast<std::byte *>(block) + headerSize;
+}
+
+void LatticeArena::deallocate(void *ptr, size_t size) {
+    if (!ptr) {
+        return;
+    }
+    void *block = static_cast<std::byte *>(ptr) - headerSize;
+    LatticeArena *arena;
+    std::memcpy(&arena, block, sizeof(arena));
+    if (arena) {
+        arena->deallocateBlock(
+            block, (size + headerSize + alignment - 1) / alignment * alignment);
+    } else {
+        ::operator delete(block);
+    }
+}
+
+void *LatticeArena::allocateBlock(size_t blockSize) {
+    ++live_;
+    auto &free = free_[blockSize / alignment];
+    if (free) {
+        void *block = free;
+        std::memcpy(&free, block, sizeof(free));
+        return block;
+    }
+    if (!current_ || offset_ + blockSize > chunkSize) {
+        if (used_ == chunks_.size()) {
+            chunks_.push_back(
+                std::make_unique_for_overwrite<std::byte[]>(chunkSize));
+        }
+        current_ = chunks_[used_++].get();
+        offset_ = 0;
+    }
+    void *block = current_ + offset_;
+    offset_ += blockSize;
+    return block;
+}
+
+void LatticeArena::deallocateBlock(void *block, size_t blockSize) {
+    --live_;
+    auto &free = free_[blockSize / alignment];
+    std::memcpy(block, &free, sizeof(free));
+    free = block;
+}
+
+void LatticeArena::reset() {
+    if (live_) {
+        return;
+    }
+    free_.fill(nullptr);
+    current_ = nullptr;
+    used_ = 0;
+}
+
+LatticeArenaScope::LatticeArenaScope(LatticeArena *arena)
+    : previous_(currentArena) {
+    currentArena = arena;
+}
+
+LatticeArenaScope::~LatticeArenaScope() { currentArena = previous_; }
+
+void *LatticeNodeData::operator new(size_t size) {
+    return LatticeArena::allocate(size);
+}
+
+void LatticeNodeData::operator delete(void *ptr, size_t size) {
+    LatticeArena::deallocate(ptr, size);
+}
+
+void *LatticeNode::operator new(size_t size) {
+    return LatticeArena::allocate(size);
+}
+
+void LatticeNode::operator delete(void *ptr, size_t size) {
+    LatticeArena::deallocate(ptr, size);
+}
+
 WordNode::WordNode(WordNode &&other) noexcept(
     std::is_nothrow_move_constructible<std::string>::value) = default;
 WordNode &WordNode::operator=(WordNode &&other) noexcept(
@@ -35,31 +134,117 @@ const SentenceResult &Lattice::sentence(size_t idx) const {
     return d->nbests_[idx];
 }
 
+LatticeMap::NodeList &LatticeMap::operator[](const SegmentGraphNode *node) {
+    Slot *slot;
+    if (node) {
+        const auto index = node->index();
+        if (index >= slots_.size()) {
+            slots_.resize(index + 1);
+        }
+        slot = &slots_[index];
+    } else {
+        slot = &end_;
+    }
+    if (slot->used && slot->node != node) {
+        // The SegmentGraphNode at this index is replaced without
+        // discardNode, the nodes are unreachable anyway.
+        slot->nodes.clear();
+        slot->sorted = 0;
+    }
+    slot->node = node;
+    slot->used = true;
+    return slot->nodes;
+}
+
+void LatticeMap::erase(const SegmentGraphNode *node) {
+    // Compare the key with all slots, the node might already be destroyed.
+    auto eraseSlot = [node](Slot &slot) {
+        if (slot.used && slot.node == node) {
+            slot.nodes.clear();
+            slot.node = nullptr;
+            slot.used = false;
+            slot.sorted = 0;
+        }
+    };
+    if (!node) {
+        eraseSlot(end_);
+        return;
+    }
+    for (auto &slot : slots_) {
+        eraseSlot(slot);
+    }
+    while (!slots_.empty() && !slots_.back().used) {
+        slots_.pop_back();
+    }
+}
+
+void LatticeMap::clear() {
+    slots_.clear();
+    end_.nodes.clear();
+    end_.used = false;
+    end_.sorted = 0;
+}
+
+void LatticeMap::sort(const SegmentGraphNode *node, size_t count) {
+    auto *slot = lookup(node);
+    if (!slot || slot->node != node) {
+        return;
+    }
+    // Sort the pointers directly, ptr_vector only has a full sort.
+    auto &pointers = slot->nodes.base();
+    auto scoreGreaterThan = [](const void *lhs, const void *rhs) {
+        return static_cast<const LatticeNode *>(lhs)->score() >
+               static_cast<const LatticeNode *>(rhs)->score();
+    };
+    if (count < pointers.size()) {
+        const auto nth = pointers.begin() + count;
+        std::nth_element(pointers.begin(), nth, pointers.end(),
+                         scoreGreaterThan);
+        std::sort(pointers.begin(), nth, scoreGreaterThan);
+    } else {
+        std::sort(pointers.begin(), pointers.end(), scoreGreaterThan);
+    }
+    slot->sorted = std::min(count, pointers.size());
+}
+
+bool Lattice::isDegraded() const {
+    FCITX_D();
+    return d->degraded_;
+}
+
+size_t Lattice::sortedSize(const SegmentGraphNode *node) const {
+    FCITX_D();
+    return d->lattice_.sortedSize(node);
+}
+
 Lattice::NodeRange Lattice::nodes(const SegmentGraphNode *node) const {
     FCITX_D();
-    auto iter = d->lattice_.find(node);
-    if (iter == d->lattice_.end()) {
+    const auto *nodes = d->lattice_.find(node);
+    if (!nodes) {
         return {};
     }
-    return {iter->second.begin(), iter->second.end()};
+    return {nodes->begin(), nodes->end()};
 }
 
 void Lattice::clear() {
     FCITX_D();
     d->lattice_.clear();
     d->nbests_.clear();
+    d->search_.reset();
+    d->degraded_ = false;
+    d->incomplete_ = false;
+    d->arena_.reset();
 }
 
 void Lattice::discardNode(
     const std::unordered_set<const SegmentGraphNode *> &nodes) {
     FCITX_D();
+    d->search_.reset();
     for (const auto *node : nodes) {
         d->lattice_.erase(node);
     }
-    for (auto &p : d->lattice_) {
-        p.second.erase_if([&nodes](const LatticeNode &node) {
-            return nodes.count(node.from());
-        });
-    }
+    d->lattice_.eraseNodesIf([&nodes](const LatticeNode &node) {
+        return nodes.contains(node.from());
+    });
 }
 } // namespace libime
@@ -12,6 +12,7 @@
 #include <algorithm>
 #include <cassert>
 #include <cstddef>
+#include <cstdint>
 #include <memory>
 #include <ranges>
 #include <string>
@@ -33,6 +34,59 @@ namespace libime {
 class LatticePrivate;
 class LatticeNode;
 
+namespace details {
+
+// Hash the text of a sequence of words, the same as hashing the concatenated
+// string but without building it. nextWord returns a pointer to the next
+// word, or nullptr at the end.
+template <typename NextWord>
+size_t wordsTextHash(NextWord nextWord) {
+    // FNV-1a.
+    uint64_t hash = 14695981039346656037ULL;
+    while (const std::string *word = nextWord()) {
+        for (char c : *word) {
+            hash ^= static_cast<unsigned char>(c);
+            hash *= 1099511628211ULL;
+        }
+    }
+    return static_cast<size_t>(hash);
+}
+
+// Compare the text of two sequences of words without building them, the
+// word boundaries do not matter.
+template <typename LhsNextWord, typename RhsNextWord>
+bool wordsTextEquals(LhsNextWord lhsNextWord, RhsNextWord rhsNextWord) {
+    std::string_view lhs;
+    std::string_view rhs;
+    while (true) {
+        while (lhs.empty()) {
+            const std::string *word = lhsNextWord();
+            if (!word) {
+                break;
+            }
+            lhs = *word;
+        }
+        while (rhs.empty()) {
+            const std::string *word = rhsNextWord();
+            if (!word) {
+                break;
+            }
+            rhs = *word;
+        }
+        if (lhs.empty() || rhs.empty()) {
+            return lhs.empty() && rhs.empty();
+        }
+        const auto length = std::min(lhs.size(), rhs.size());
+        if (lhs.substr(0, length) != rhs.substr(0, length)) {
+            return false;
+        }
+        lhs.remove_prefix(length);
+        rhs.remove_prefix(length);
+    }
+}
+
+} // namespace details
+
 class SentenceResult {
 public:
     using Sentence = std::vector<const LatticeNode *>;
@@ -57,7 +111,27 @@ public:
 
     std::string toString() const;
 
+    /**
+     * Hash of the text, which is equal if toString() is equal.
+     *
+     * It is computed without building the string, so it can be used to
+     * remove duplicates cheaply.
+     *
+     * @since 1.1.16
+     */
+    size_t textHash() const;
+
+    /**
+     * Whether toString() of two sentences are equal, without building them.
+     *
+     * @since 1.1.16
+     */
+    bool textEquals(const SentenceResult &other) const;
+
 private:
+    // Returns a callable to iterate over the words of the sentence.
+    auto nextWord() const;
+
     Sentence sentence_;
     float score_;
 };
@@ -84,6 +158,15 @@ protected:
 class LIBIMECORE_EXPORT LatticeNodeData {
 public:
     virtual ~LatticeNodeData() = default;
+
+    /**
+     * Allocate from the arena of the lattice being decoded.
+     *
+     * @see LatticeNode::operator new
+     * @since 1.1.16
+     */
+    static void *operator new(size_t size);
+    static void operator delete(void *ptr, size_t size);
 };
 
 class LIBIMECORE_EXPORT LatticeNode : public WordNode {
@@ -157,6 +240,20 @@ public:
 
     State &state() { return state_; }
 
+    /**
+     * Allocate from the arena of the lattice being decoded.
+     *
+     * Node created with new inside Decoder::createLatticeNodeImpl, including
+     * the subclass of LatticeNode, is allocated from the arena owned by the
+     * lattice, which keeps the memory for the next decoding after
+     * Lattice::clear. Outside of Decoder::decode it falls back to the global
+     * operator new.
+     *
+     * @since 1.1.16
+     */
+    static void *operator new(size_t size);
+    static void operator delete(void *ptr, size_t size);
+
 protected:
     SegmentGraphPath path_;
     float cost_;
@@ -165,6 +262,21 @@ protected:
     LatticeNode *prev_ = nullptr;
 };
 
+inline auto SentenceResult::nextWord() const {
+    return [iter = sentence_.begin(),
+            end = sentence_.end()]() mutable -> const std::string * {
+        return iter == end ? nullptr : &(*iter++)->word();
+    };
+}
+
+inline size_t SentenceResult::textHash() const {
+    return details::wordsTextHash(nextWord());
+}
+
+inline bool SentenceResult::textEquals(const SentenceResult &other) const {
+    return details::wordsTextEquals(nextWord(), other.nextWord());
+}
+
 inline std::string SentenceResult::toString() const {
     return fcitx::stringutils::join(
         sentence_ |
@@ -197,6 +309,14 @@ public:
 
     size_t sentenceSize() const;
     const SentenceResult &sentence(size_t idx) const;
+    /**
+     * Whether the last decode ran out of its budget, so the result might be
+     * worse than an unlimited decode.
+     *
+     * @see DecodeBudget
+     * @since 1.1.16
+     */
+    bool isDegraded() const;
     void clear();
     void discardNode(const std::unordered_set<const SegmentGraphNode *> &node);
 
@@ -206,6 +326,15 @@ public:
 
     NodeRange nodes(const SegmentGraphNode *node) const;
 
+    /**
+     * Number of nodes at the front of nodes(node), which are the best ones
+     * and sorted by score. The rest of the nodes are not in order.
+     *
+     * @see Decoder::setPartialSort
+     * @since 1.1.16
+     */
+    size_t sortedSize(const SegmentGraphNode *node) const;
+
 private:
     std::unique_ptr<LatticePrivate> d_ptr;
     FCITX_DECLARE_PRIVATE(Lattice);
@@ -6,22 +6,272 @@
 #ifndef _FCITX_LIBIME_CORE_LATTICE_P_H_
 #define _FCITX_LIBIME_CORE_LATTICE_P_H_
 
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <limits>
+#include <memory>
+#include <queue>
 #include <unordered_map>
+#include <utility>
 #include <vector>
+#include <boost/container_hash/hash.hpp>
 #include <boost/ptr_container/ptr_vector.hpp>
 #include <libime/core/lattice.h>
 #include <libime/core/segmentgraph.h>
 
 namespace libime {
 
-using LatticeMap = std::unordered_map<const SegmentGraphNode *,
-                                      boost::ptr_vector<LatticeNode>>;
+// Lattice nodes grouped by the SegmentGraphNode they end at. Since there is
+// at most one SegmentGraphNode for each index of the SegmentGraph, the
+// groups are stored in a vector indexed by SegmentGraphNode::index. The node
+// of sentence end is stored with nullptr.
+//
+// The key is only dereferenced by find and operator[], so discardNode may
+// still be used after the SegmentGraphNode is gone.
+class LatticeMap {
+public:
+    using NodeList = boost::ptr_vector<LatticeNode>;
+
+    bool contains(const SegmentGraphNode *node) const {
+        return find(node) != nullptr;
+    }
+
+    NodeList *find(const SegmentGraphNode *node) {
+        auto *slot = lookup(node);
+        return slot && slot->node == node ? &slot->nodes : nullptr;
+    }
+    const NodeList *find(const SegmentGraphNode *node) const {
+        return const_cast<LatticeMap *>(this)->find(node);
+    }
+
+    NodeList &operator[](const SegmentGraphNode *node);
+
+    void erase(const SegmentGraphNode *node);
+    void clear();
+
+    // Number of nodes at the front of the group, which are the best ones and
+    // sorted by score.
+    size_t sortedSize(const SegmentGraphNode *node) const {
+        const auto *slot = const_cast<LatticeMap *>(this)->lookup(node);
+        return slot && slot->node == node ? slot->sorted : 0;
+    }
+    // Sort the group, so the first count nodes are the best ones and sorted
+    // by score. The rest of the nodes are left in any order.
+    void sort(const SegmentGraphNode *node, size_t count);
+    // Same as sort, but do nothing if enough nodes are sorted already.
+    void ensureSorted(const SegmentGraphNode *node, size_t count) {
+        auto *slot = lookup(node);
+        if (slot && slot->node == node &&
+            slot->sorted < std::min(count, slot->nodes.size())) {
+            sort(node, count);
+        }
+    }
+
+    // Remove the nodes matching pred from all groups.
+    template <typename Pred>
+    void eraseNodesIf(Pred pred) {
+        auto eraseFromSlot = [&pred](Slot &slot) {
+            // The order is kept, so the sorted nodes are still sorted.
+            slot.sorted -= std::count_if(
+                slot.nodes.begin(), slot.nodes.begin() + slot.sorted, pred);
+            slot.nodes.erase_if(pred);
+        };
+        for (auto &slot : slots_) {
+            if (slot.used) {
+                eraseFromSlot(slot);
+            }
+        }
+        if (end_.used) {
+            eraseFromSlot(end_);
+        }
+    }
+
+    // Call callback with every SegmentGraphNode and its lattice nodes.
+    template <typename Callback>
+    void foreach(Callback callback) {
+        for (auto &slot : slots_) {
+            if (slot.used) {
+                callback(slot.node, slot.nodes);
+            }
+        }
+        if (end_.used) {
+            callback(end_.node, end_.nodes);
+        }
+    }
+
+private:
+    struct Slot {
+        Slot() = default;
+        // ptr_vector is not nothrow movable, which would make vector copy
+        // the nodes on reallocation.
+        Slot(Slot &&other) noexcept
+            : node(other.node), used(other.used), sorted(other.sorted) {
+            nodes.swap(other.nodes);
+        }
+        Slot &operator=(Slot &&other) noexcept {
+            node = other.node;
+            used = other.used;
+            sorted = other.sorted;
+            nodes.swap(other.nodes);
+            return *this;
+        }
+
+        const SegmentGraphNode *node = nullptr;
+        bool used = false;
+        // See sortedSize.
+        size_t sorted = 0;
+        NodeList nodes;
+    };
+
+    Slot *lookup(const SegmentGraphNode *node) {
+        if (!node) {
+            return end_.used ? &end_ : nullptr;
+        }
+        const auto index = node->index();
+        if (index >= slots_.size() || !slots_[index].used) {
+            return nullptr;
+        }
+        return &slots_[index];
+    }
+
+    std::vector<Slot> slots_;
+    Slot end_;
+};
+
+// Slab allocator of lattice nodes and their data. Blocks are grouped by
+// size, a freed block is reused by the next allocation of the same size, and
+// the memory is only returned to the system when the arena is destroyed.
+class LatticeArena {
+public:
+    LatticeArena() = default;
+    LatticeArena(const LatticeArena &) = delete;
+    LatticeArena &operator=(const LatticeArena &) = delete;
+
+    // Allocate from the arena of the current thread, or the global heap.
+    static void *allocate(size_t size);
+    static void deallocate(void *ptr, size_t size);
+
+    // Start over from the first chunk if nothing is allocated.
+    void reset();
+
+private:
+    friend class LatticeArenaScope;
+    static constexpr size_t alignment = alignof(std::max_align_t);
+    // Each block starts with the owner arena, so deallocate knows where it
+    // comes from.
+    static constexpr size_t headerSize = alignment;
+    static constexpr size_t chunkSize = 64 * 1024;
+    static constexpr size_t maxBlockSize = 1024;
+
+    void *allocateBlock(size_t blockSize);
+    void deallocateBlock(void *block, size_t blockSize);
+
+    std::vector<std::unique_ptr<std::byte[]>> chunks_;
+    // Number of chunks in use, the last one is current_.
+    size_t used_ = 0;
+    std::byte *current_ = nullptr;
+    size_t offset_ = 0;
+    size_t live_ = 0;
+    std::array<void *, (maxBlockSize / alignment) + 1> free_{};
+};
+
+// Allocation of nodes and node data in current thread uses the arena until
+// the scope ends.
+class LatticeArenaScope {
+public:
+    explicit LatticeArenaScope(LatticeArena *arena);
+    ~LatticeArenaScope();
+    LatticeArenaScope(const LatticeArenaScope &) = delete;
+    LatticeArenaScope &operator=(const LatticeArenaScope &) = delete;
+
+private:
+    LatticeArena *previous_;
+};
+
+constexpr int MAX_BACKWARD_SEARCH_SIZE = 10000;
+
+class NBestNode {
+public:
+    NBestNode(const LatticeNode *node,
+              size_t next = std::numeric_limits<size_t>::max())
+        : node_(node), next_(next) {}
+
+    const NBestNode *next(const std::vector<NBestNode> &pool) const {
+        return next_ == std::numeric_limits<size_t>::max() ? nullptr
+                                                           : &pool[next_];
+    }
+
+    const LatticeNode *node() const { return node_; }
+
+    // for nbest
+    float gn_ = 0.0F;
+    float fn_ = -std::numeric_limits<float>::max();
+
+private:
+    const LatticeNode *const node_;
+    size_t next_ = std::numeric_limits<size_t>::max();
+};
+
+struct NBestNodeLess {
+    NBestNodeLess(const std::vector<NBestNode> &pool) : pool_(pool) {}
+    bool operator()(size_t lhs, size_t rhs) const {
+        return pool_[lhs].fn_ < pool_[rhs].fn_;
+    }
+    const std::vector<NBestNode> &pool_;
+};
+
+// State of the backward search, kept with the lattice so more sentences can
+// be found after decode, see Decoder::nextSentences. The queue refers to the
+// pool, so it can't be moved.
+class NBestSearch {
+public:
+    NBestSearch(const LatticeNode *bos, const LatticeNode *eos, float max,
+                float min, size_t beamSize)
+        : bos_(bos), eos_(eos), max_(max), min_(min), beamSize_(beamSize) {}
+    NBestSearch(const NBestSearch &) = delete;
+    NBestSearch &operator=(const NBestSearch &) = delete;
+
+    struct ModelLookupCacheHash {
+        size_t operator()(const std::pair<const LatticeNode *,
+                                          const LatticeNode *> &key) const {
+            size_t seed = std::hash<const LatticeNode *>()(key.first);
+            boost::hash_combine(seed,
+                                std::hash<const LatticeNode *>()(key.second));
+            return seed;
+        }
+    };
+
+    const LatticeNode *bos_;
+    const LatticeNode *eos_;
+    float max_;
+    float min_;
+    size_t beamSize_;
+    std::vector<NBestNode> pool_;
+    std::priority_queue<size_t, std::vector<size_t>, NBestNodeLess> queue_{
+        NBestNodeLess(pool_)};
+    // Index in pool of the found sentences, by the hash of their text.
+    std::unordered_multimap<size_t, size_t> dup_;
+    std::unordered_map<std::pair<const LatticeNode *, const LatticeNode *>,
+                       float, ModelLookupCacheHash>
+        modelCache_;
+    // No more sentences can be found.
+    bool done_ = false;
+};
 
 class LatticePrivate {
 public:
+    // Declared first, so it outlives all the nodes.
+    LatticeArena arena_;
     LatticeMap lattice_;
 
     std::vector<SentenceResult> nbests_;
+    // Only valid until the lattice is changed.
+    std::unique_ptr<NBestSearch> search_;
+    bool degraded_ = false;
+    // Decode ran out of budget before the forward search is done, so the
+    // lattice can't be reused by the next decode.
+    bool incomplete_ = false;
 };
 } // namespace libime
 
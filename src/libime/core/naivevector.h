@@ -7,6 +7,7 @@
 #ifndef NAIVEVECTOR_H
 #define NAIVEVECTOR_H
 
+#include <algorithm>
 #include <cstddef>
 #include <cstdlib>
 #include <cstring>
@@ -37,9 +38,14 @@ struct naivevector {
     using reverse_iterator = std::reverse_iterator<iterator>;
     using const_reverse_iterator = std::reverse_iterator<const_iterator>;
 
-    naivevector() noexcept : m_start(nullptr), m_end(nullptr), m_cap(nullptr) {}
+    naivevector() noexcept
+        : m_start(nullptr), m_end(nullptr), m_cap(nullptr), m_owned(true) {}
 
-    ~naivevector() noexcept { std::free(m_start); }
+    ~naivevector() noexcept {
+        if (m_owned) {
+            std::free(m_start);
+        }
+    }
     naivevector(const naivevector &other) : naivevector() {
         reserve(other.size());
         for (auto value : other) {
@@ -58,8 +64,22 @@ struct naivevector {
         swap(m_start, __other.m_start);
         swap(m_end, __other.m_end);
         swap(m_cap, __other.m_cap);
+        swap(m_owned, __other.m_owned);
     }
 
+    // Refer to external memory without taking the ownership. The memory is
+    // treated as read-only, any reallocation will copy the content into owned
+    // memory first. Copy of a borrowed vector always owns its memory.
+    static naivevector borrow(const value_type *data, size_type size) {
+        naivevector result;
+        result.m_start = const_cast<pointer>(data);
+        result.m_end = result.m_cap = result.m_start + size;
+        result.m_owned = false;
+        return result;
+    }
+
+    bool owned() const noexcept { return m_owned; }
+
     // Iterators.
     iterator begin() noexcept { return iterator(data()); }
 
@@ -199,19 +219,32 @@ struct naivevector {
 private:
     void _realloc_array(size_type bytes) {
         if (bytes == 0) {
-            std::free(m_start);
+            if (m_owned) {
+                std::free(m_start);
+            }
             m_start = m_end = m_cap = nullptr;
+            m_owned = true;
         } else {
             auto old_bytes = size_type(reinterpret_cast<char *>(m_end) -
                                        reinterpret_cast<char *>(m_start));
-            auto *new_start =
-                reinterpret_cast<pointer>(std::realloc(m_start, bytes));
+            pointer new_start = nullptr;
+            if (m_owned) {
+                new_start =
+                    reinterpret_cast<pointer>(std::realloc(m_start, bytes));
+            } else {
+                old_bytes = std::min(old_bytes, bytes);
+                new_start = reinterpret_cast<pointer>(std::malloc(bytes));
+                if (new_start && old_bytes) {
+                    std::memcpy(new_start, m_start, old_bytes);
+                }
+            }
             if (new_start) {
                 m_start = new_start;
                 m_cap = reinterpret_cast<pointer>(
                     reinterpret_cast<char *>(new_start) + bytes);
                 m_end = reinterpret_cast<pointer>(
                     reinterpret_cast<char *>(new_start) + old_bytes);
+                m_owned = true;
             } else {
                 throw std::bad_alloc();
             }
@@ -221,6 +254,7 @@ private:
     value_type *m_start;
     value_type *m_end;
     value_type *m_cap;
+    bool m_owned;
 };
 
 template <typename T>
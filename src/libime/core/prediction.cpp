@@ -88,16 +88,11 @@ Prediction::predictWithScore(const State &state,
             search = sentence.back();
         }
         search += "|";
-        const auto &trie = file->predictionTrie();
-        trie.foreach(search, [&trie, &words,
-                              maxSize](DATrie<float>::value_type, size_t len,
-                                       DATrie<float>::position_type pos) {
-            std::string buf;
-            trie.suffix(buf, len, pos);
-            words.emplace(std::move(buf));
-
-            return maxSize <= 0 || words.size() < maxSize;
-        });
+        const auto &trie = file->predictionIndex();
+        // Take the words with highest bigram score first.
+        for (const auto &entry : trie.topK(search, maxSize)) {
+            words.emplace(entry.first.substr(search.size()));
+        }
     }
 
     if (d->bigram_) {
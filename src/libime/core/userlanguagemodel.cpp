@@ -6,12 +6,14 @@
 
 #include "userlanguagemodel.h"
 #include <algorithm>
+#include <array>
 #include <cassert>
 #include <cmath>
 #include <istream>
 #include <iterator>
 #include <memory>
 #include <ostream>
+#include <span>
 #include <string>
 #include <string_view>
 #include <utility>
@@ -139,6 +141,56 @@ float UserLanguageModel::score(const State &state, const WordNode &word,
     return std::max(score, sum_log_prob(score + d->wa_, userScore + d->wb_));
 }
 
+void UserLanguageModel::scoreBatch(std::span<const State *const> states,
+                                   const WordNode &word,
+                                   std::span<float> scores,
+                                   std::span<State> outs) const {
+    FCITX_D();
+    assert(states.size() == scores.size() && states.size() == outs.size());
+    if (d->useOnlyUnigram_) {
+        // The score doesn't depend on the state.
+        State out;
+        const float score = LanguageModel::score(d->nullState_, word, out);
+        std::ranges::fill(scores, score);
+        std::ranges::fill(outs, out);
+    } else {
+        LanguageModel::scoreBatch(states, word, scores, outs);
+    }
+
+    constexpr size_t chunkSize = 32;
+    std::array<const WordNode *, chunkSize> prevs;
+    std::array<float, chunkSize> userScores;
+    for (size_t start = 0; start < states.size(); start += chunkSize) {
+        const auto size = std::min(chunkSize, states.size() - start);
+        for (size_t i = 0; i < size; i++) {
+            prevs[i] = d->wordFromState(*states[start + i]);
+        }
+        d->history_.scoreWithCodeBatch(
+            std::span(prevs).first(size), &word, d->extractor_,
+            std::span(userScores).first(size));
+        for (size_t i = 0; i < size; i++) {
+            auto &score = scores[start + i];
+            score = std::max(score, sum_log_prob(score + d->wa_,
+                                                 userScores[i] + d->wb_));
+            d->setWordToState(outs[start + i], &word);
+        }
+    }
+}
+
+float UserLanguageModel::unigramScore(const WordNode &word) const {
+    FCITX_D();
+    // The same as score after nullState, but the static part is read from
+    // the unigram table.
+    const float score = LanguageModel::unigramScore(word);
+    float userScore;
+    if (d->extractor_) {
+        userScore = d->history_.scoreWithCode(nullptr, &word, d->extractor_);
+    } else {
+        userScore = d->history_.score(nullptr, &word);
+    }
+    return std::max(score, sum_log_prob(score + d->wa_, userScore + d->wb_));
+}
+
 bool UserLanguageModel::isUnknown(WordIndex idx, std::string_view view) const {
     FCITX_D();
     return idx == unknown() && d->history_.isUnknown(view);
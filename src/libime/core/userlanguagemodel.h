@@ -9,6 +9,7 @@
 #include <istream>
 #include <memory>
 #include <ostream>
+#include <span>
 #include <string>
 #include <string_view>
 #include <vector>
@@ -45,6 +46,10 @@ public:
     const State &nullState() const override;
     float score(const State &state, const WordNode &word,
                 State &out) const override;
+    void scoreBatch(std::span<const State *const> states, const WordNode &word,
+                    std::span<float> scores,
+                    std::span<State> outs) const override;
+    float unigramScore(const WordNode &word) const override;
     bool isUnknown(WordIndex idx, std::string_view view) const override;
 
     bool containsNonUnigram(const std::vector<std::string> &words) const;
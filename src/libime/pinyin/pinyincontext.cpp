@@ -6,6 +6,7 @@
 #include "pinyincontext.h"
 #include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <cstddef>
 #include <functional>
 #include <iterator>
@@ -94,6 +95,7 @@ struct SelectedPinyin {
 
 struct CandidateDedupByPinyin {
     std::string text_;
+    size_t textHash_;
     std::string fullPinyin_;
 
     bool operator==(const CandidateDedupByPinyin &other) const {
@@ -103,7 +105,7 @@ struct CandidateDedupByPinyin {
 
 struct CandidateDedupByPinyinHash {
     size_t operator()(const CandidateDedupByPinyin &key) const {
-        size_t seed = std::hash<std::string>()(key.text_);
+        size_t seed = key.textHash_;
         boost::hash_combine(seed, std::hash<std::string>()(key.fullPinyin_));
         return seed;
     }
@@ -111,11 +113,13 @@ struct CandidateDedupByPinyinHash {
 
 CandidateDedupByPinyin candidateDedupByPinyin(const SentenceResult &candidate) {
     return {.text_ = candidate.toString(),
+            .textHash_ = candidate.textHash(),
             .fullPinyin_ = sentenceEncodedFullPinyin(candidate)};
 }
 
 struct CandidateDedupBySelectRange {
     std::string text_;
+    size_t textHash_;
     std::string end_;
 
     bool operator==(const CandidateDedupBySelectRange &other) const {
@@ -125,7 +129,7 @@ struct CandidateDedupBySelectRange {
 
 struct CandidateDedupBySelectRangeHash {
     size_t operator()(const CandidateDedupBySelectRange &key) const {
-        size_t seed = std::hash<std::string>()(key.text_);
+        size_t seed = key.textHash_;
         boost::hash_combine(seed, std::hash<std::string>()(key.end_));
         return seed;
     }
@@ -134,6 +138,7 @@ struct CandidateDedupBySelectRangeHash {
 CandidateDedupBySelectRange
 candidateDedupBySelectRange(const SentenceResult &candidate) {
     return {.text_ = candidate.toString(),
+            .textHash_ = candidate.textHash(),
             .end_ = std::to_string(candidateSelectTo(candidate))};
 }
 
@@ -144,6 +149,21 @@ bool hasCorrection(const SentenceResult &candidate) {
         });
 }
 
+// Word candidate found in lattice, the SentenceResult is only built when it
+// is added to the candidates.
+struct PendingWordCandidate {
+    const LatticeNode *node_;
+    float adjust_;
+
+    float score() const { return node_->score() + adjust_; }
+};
+
+// Heap order of pending word candidates, the best one first.
+bool pendingWordCandidateLess(const PendingWordCandidate &lhs,
+                              const PendingWordCandidate &rhs) {
+    return lhs.score() < rhs.score();
+}
+
 } // namespace
 
 class PinyinContextPrivate : public fcitx::QPtrHolder<PinyinContext> {
@@ -159,8 +179,25 @@ public:
     SegmentGraph segs_;
     Lattice lattice_;
     PinyinMatchState matchState_;
+    LanguageModelCache modelCache_;
+    DecodeStats decodeStats_;
     std::vector<SentenceResult> candidates_;
     std::unordered_set<std::string> candidatesSet_;
+    // Keys of candidates_ to remove duplicates, see update.
+    std::unordered_set<CandidateDedupByPinyin, CandidateDedupByPinyinHash>
+        duplicateByPinyin_;
+    std::unordered_set<CandidateDedupBySelectRange,
+                       CandidateDedupBySelectRangeHash>
+        duplicateByRange_;
+    // Sentences of lattice_ in [nextSentence_, sentenceEnd_) are added before
+    // the word candidates, see loadCandidates.
+    size_t nextSentence_ = 0;
+    size_t sentenceEnd_ = 0;
+    // Word candidates not added yet, a heap by score.
+    std::vector<PendingWordCandidate> pendingWords_;
+    // Number of word candidates counted by wordCandidateLimit.
+    size_t wordCount_ = 0;
+    size_t candidatePageSize_ = 0;
     mutable bool candidatesToCursorNeedUpdate_ = true;
     mutable std::vector<SentenceResult> candidatesToCursor_;
     mutable std::unordered_set<std::string> candidatesToCursorSet_;
@@ -195,7 +232,83 @@ public:
         candidatesToCursor_.clear();
         candidatesToCursorNeedUpdate_ = false;
         candidatesSet_.clear();
+        duplicateByPinyin_.clear();
+        duplicateByRange_.clear();
         candidatesToCursorSet_.clear();
+        nextSentence_ = sentenceEnd_ = 0;
+        pendingWords_.clear();
+        wordCount_ = 0;
+    }
+
+    // Append candidate unless it is a duplicate of an existing one, or a word
+    // over wordCandidateLimit.
+    bool addCandidate(SentenceResult candidate, bool isWord) {
+        auto byPinyin = candidateDedupByPinyin(candidate);
+        if (duplicateByPinyin_.contains(byPinyin)) {
+            return false;
+        }
+        auto byRange = candidateDedupBySelectRange(candidate);
+        if (duplicateByRange_.contains(byRange) && hasCorrection(candidate)) {
+            return false;
+        }
+
+        const auto limit = ime_->wordCandidateLimit();
+        if (isWord && limit) {
+            const bool isSinglePinyinWord =
+                candidate.sentence().size() == 1 &&
+                candidate.sentence()
+                        .front()
+                        ->as<PinyinLatticeNode>()
+                        .encodedPinyin()
+                        .size() == 2;
+            if (!isSinglePinyinWord) {
+                if (wordCount_ >= limit) {
+                    return false;
+                }
+                wordCount_++;
+            }
+        }
+
+        candidatesSet_.insert(byPinyin.text_);
+        duplicateByPinyin_.insert(std::move(byPinyin));
+        duplicateByRange_.insert(std::move(byRange));
+        candidates_.push_back(std::move(candidate));
+        return true;
+    }
+
+    // Append the next sentence of lattice_, searching more if needed.
+    bool loadNextSentence(size_t searchCount) {
+        if (nextSentence_ == lattice_.sentenceSize() &&
+            !ime_->decoder()->nextSentences(lattice_, searchCount)) {
+            return false;
+        }
+        addCandidate(lattice_.sentence(nextSentence_++), false);
+        return true;
+    }
+
+    // Append up to count candidates, the nbest sentences first and then the
+    // word candidates by score. Returns the number of candidates added.
+    size_t loadCandidates(size_t count) {
+        const auto oldSize = candidates_.size();
+        while (candidates_.size() - oldSize < count) {
+            const auto remain = count - (candidates_.size() - oldSize);
+            if (nextSentence_ < sentenceEnd_) {
+                if (!loadNextSentence(
+                        std::min(sentenceEnd_ - nextSentence_, remain))) {
+                    sentenceEnd_ = nextSentence_;
+                }
+                continue;
+            }
+            if (pendingWords_.empty()) {
+                break;
+            }
+            std::ranges::pop_heap(pendingWords_, pendingWordCandidateLess);
+            const auto word = pendingWords_.back();
+            pendingWords_.pop_back();
+            addCandidate(word.node_->toSentenceResult(word.adjust_), true);
+        }
+        candidatesToCursorNeedUpdate_ = true;
+        return candidates_.size() - oldSize;
     }
 
     void updateCandidatesToCursor() const {
@@ -573,6 +686,48 @@ const std::vector<SentenceResult> &PinyinContext::candidates() const {
     return d->candidates_;
 }
 
+size_t PinyinContext::loadMoreSentences(size_t count) {
+    FCITX_D();
+    if (selected() || d->candidates_.empty()) {
+        return 0;
+    }
+    // Appended after the existing candidates, so the candidates that are
+    // already shown keep their position.
+    const auto oldSize = d->candidates_.size();
+    while (d->candidates_.size() - oldSize < count) {
+        if (!d->loadNextSentence(count - (d->candidates_.size() - oldSize))) {
+            break;
+        }
+    }
+    d->sentenceEnd_ = std::max(d->sentenceEnd_, d->nextSentence_);
+    d->candidatesToCursorNeedUpdate_ = true;
+    return d->candidates_.size() - oldSize;
+}
+
+size_t PinyinContext::candidatePageSize() const {
+    FCITX_D();
+    return d->candidatePageSize_;
+}
+
+void PinyinContext::setCandidatePageSize(size_t size) {
+    FCITX_D();
+    d->candidatePageSize_ = size;
+}
+
+size_t PinyinContext::loadMoreCandidates(size_t count) {
+    FCITX_D();
+    if (selected()) {
+        return 0;
+    }
+    return d->loadCandidates(count);
+}
+
+bool PinyinContext::hasMoreCandidates() const {
+    FCITX_D();
+    return !selected() &&
+           (d->nextSentence_ < d->sentenceEnd_ || !d->pendingWords_.empty());
+}
+
 const std::unordered_set<std::string> &PinyinContext::candidateSet() const {
     FCITX_D();
     return d->candidatesSet_;
@@ -701,21 +856,33 @@ void PinyinContext::update() {
             });
         auto &graph = d->segs_;
 
-        d->ime_->decoder()->decode(d->lattice_, d->segs_, d->ime_->nbest(),
-                                   state, d->ime_->maxDistance(),
-                                   d->ime_->minPath(), d->ime_->beamSize(),
-                                   d->ime_->frameSize(), &d->matchState_);
+        DecodeOptions options;
+        options.cache = &d->modelCache_;
+        options.stats = &d->decodeStats_;
+        if (d->ime_->decodeTimeLimit().count() > 0) {
+            options.budget.deadline =
+                std::chrono::steady_clock::now() + d->ime_->decodeTimeLimit();
+        }
+        // With candidate page size, only the sentences of the first page are
+        // searched, the rest are searched by loadMoreCandidates.
+        const auto nbest = d->ime_->nbest();
+        const auto pageSize = d->candidatePageSize_;
+        d->ime_->decoder()->decode(
+            d->lattice_, d->segs_, pageSize ? std::min(nbest, pageSize) : nbest,
+            state, d->ime_->maxDistance(), d->ime_->minPath(),
+            d->ime_->beamSize(), d->ime_->frameSize(), &d->matchState_,
+            options);
 
         d->clearCandidates();
 
-        // Add n-best result.
-        for (size_t i = 0, e = d->lattice_.sentenceSize(); i < e; i++) {
-            d->candidates_.push_back(d->lattice_.sentence(i));
-        }
+        // Add n-best result. Out of budget, only the sentences found are used.
+        d->sentenceEnd_ = d->lattice_.isDegraded()
+                              ? d->lattice_.sentenceSize()
+                              : std::max(nbest, d->lattice_.sentenceSize());
 
         const auto *bos = &graph.start();
+        auto &pendingWords = d->pendingWords_;
 
-        auto beginSize = d->candidates_.size();
         for (size_t i = graph.size(); i > 0; i--) {
             float min = 0;
             float max = -std::numeric_limits<float>::max();
@@ -736,8 +903,7 @@ void PinyinContext::update() {
                             min = std::min(latticeNode.score(), min);
                             max = std::max(latticeNode.score(), max);
                         }
-                        d->candidates_.push_back(
-                            latticeNode.toSentenceResult(adjust));
+                        pendingWords.push_back({&latticeNode, adjust});
                     }
                 }
             }
@@ -756,8 +922,7 @@ void PinyinContext::update() {
                             static_cast<const PinyinLatticeNode &>(latticeNode)
                                     .encodedPinyin()
                                     .size() <= 2) {
-                            d->candidates_.push_back(
-                                latticeNode.toSentenceResult(adjust));
+                            pendingWords.push_back({&latticeNode, adjust});
                         }
                     }
                 }
@@ -773,65 +938,16 @@ void PinyinContext::update() {
                         latticeNode.score() + d->ime_->maxDistance() > max &&
                         !static_cast<const PinyinLatticeNode &>(latticeNode)
                              .anyCorrectionOnPath()) {
-                        d->candidates_.push_back(
-                            latticeNode.toSentenceResult(adjust));
+                        pendingWords.push_back({&latticeNode, adjust});
                     }
                 }
             }
         }
-        std::sort(d->candidates_.begin() + beginSize, d->candidates_.end(),
-                  std::greater<>());
-        {
-            size_t index = 0;
-            size_t count = 0;
-            const auto limit = d->ime_->wordCandidateLimit();
-            std::unordered_set<CandidateDedupByPinyin,
-                               CandidateDedupByPinyinHash>
-                duplicateByPinyin;
-            std::unordered_set<CandidateDedupBySelectRange,
-                               CandidateDedupBySelectRangeHash>
-                duplicateByRange;
-            auto &candidatesSet = d->candidatesSet_;
-            candidatesSet.clear();
-            std::erase_if(
-                d->candidates_,
-                [&candidatesSet, &duplicateByPinyin, &duplicateByRange, &index,
-                 &count, beginSize, limit](const SentenceResult &candidate) {
-                    bool beforeBeginSize = index++ < beginSize;
-                    auto byPinyin = candidateDedupByPinyin(candidate);
-                    if (duplicateByPinyin.contains(byPinyin)) {
-                        return true;
-                    }
-                    auto byRange = candidateDedupBySelectRange(candidate);
-                    if (duplicateByRange.contains(byRange) &&
-                        hasCorrection(candidate)) {
-                        return true;
-                    }
-
-                    if (!beforeBeginSize && limit) {
-                        const bool isSinglePinyinWord =
-                            candidate.sentence().size() == 1 &&
-                            candidate.sentence()
-                                    .front()
-                                    ->as<PinyinLatticeNode>()
-                                    .encodedPinyin()
-                                    .size() == 2;
-                        if (!isSinglePinyinWord) {
-                            if (count >= limit) {
-                                return true;
-                            }
-                            count++;
-                        }
-                    }
-
-                    candidatesSet.insert(byPinyin.text_);
-                    duplicateByPinyin.insert(std::move(byPinyin));
-                    duplicateByRange.insert(std::move(byRange));
-                    return false;
-                });
-        }
-
-        d->candidatesToCursorNeedUpdate_ = true;
+        // Word candidates are sorted by score when they are added, so only
+        // the ones on the loaded pages are built and sorted.
+        std::ranges::make_heap(pendingWords, pendingWordCandidateLess);
+        d->loadCandidates(pageSize ? pageSize
+                                   : std::numeric_limits<size_t>::max());
     }
 
     if (cursor() < selectedLength()) {
@@ -1190,6 +1306,11 @@ PinyinContext::contextWordsWithPinyin() const {
     return words;
 }
 
+const DecodeStats &PinyinContext::decodeStats() const {
+    FCITX_D();
+    return d->decodeStats_;
+}
+
 bool PinyinContext::learnWord() { return false; }
 
 PinyinIME *PinyinContext::ime() const {
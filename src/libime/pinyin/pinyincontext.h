@@ -15,6 +15,7 @@
 #include <utility>
 #include <vector>
 #include <fcitx-utils/macros.h>
+#include <libime/core/decoder.h>
 #include <libime/core/inputbuffer.h>
 #include <libime/core/languagemodel.h>
 #include <libime/core/lattice.h>
@@ -42,6 +43,68 @@ public:
 
     const std::vector<SentenceResult> &candidates() const;
 
+    /**
+     * Add more sentences to the candidates.
+     *
+     * Only nbest sentences are computed when the input changes, this
+     * continues the search to add up to count more, which are appended after
+     * all existing candidates, so the candidates already shown are not
+     * moved. Sentences that are duplicates of a candidate, the same way as
+     * candidates() removes duplicates, are skipped.
+     *
+     * With a candidate page size, the sentences within nbest that are not
+     * loaded yet are added first.
+     *
+     * @param count number of sentences to add
+     * @return number of sentences added, 0 if there is no more.
+     * @since 1.1.16
+     */
+    size_t loadMoreSentences(size_t count);
+
+    /**
+     * The number of candidates built when the input changes.
+     *
+     * @see setCandidatePageSize
+     * @since 1.1.16
+     */
+    size_t candidatePageSize() const;
+
+    /**
+     * Only build the first page of candidates when the input changes.
+     *
+     * By default, the value is 0, and all nbest sentences and word candidates
+     * are built when the input changes. Otherwise, decode only searches the
+     * sentences of the first page, and candidates() only has the first size
+     * candidates. The following pages are added in the same order with
+     * loadMoreCandidates, so the time of showing the first page does not
+     * depend on nbest. Takes effect on the next input change.
+     *
+     * @since 1.1.16
+     */
+    void setCandidatePageSize(size_t size);
+
+    /**
+     * Add up to count candidates after the loaded ones.
+     *
+     * The candidates are added in the same order as without candidate page
+     * size: the rest of the nbest sentences first, then the word candidates.
+     *
+     * @param count number of candidates to add
+     * @return number of candidates added, 0 if there is no more.
+     * @see setCandidatePageSize
+     * @since 1.1.16
+     */
+    size_t loadMoreCandidates(size_t count);
+
+    /**
+     * Whether loadMoreCandidates may add more candidates.
+     *
+     * It may still add none if all the rest are duplicates.
+     *
+     * @since 1.1.16
+     */
+    bool hasMoreCandidates() const;
+
     /**
      * Return the set of candidates, useful for deduplication.
      *
@@ -187,6 +250,14 @@ public:
      */
     std::vector<HistoryBigram::WordWithCode> contextWordsWithPinyin() const;
 
+    /**
+     * Get the statistics of the last decode, which is updated whenever the
+     * input changes.
+     * @return statistics of the last decode
+     * @since 1.1.16
+     */
+    const DecodeStats &decodeStats() const;
+
 protected:
     bool typeImpl(const char *s, size_t length) override;
 
@@ -6,11 +6,14 @@
 
 #include "pinyindictionary.h"
 #include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <cmath>
 #include <cstddef>
 #include <cstdint>
 #include <fstream>
+#include <functional>
+#include <future>
 #include <iomanip>
 #include <ios>
 #include <istream>
@@ -24,6 +27,7 @@
 #include <string>
 #include <string_view>
 #include <tuple>
+#include <unordered_map>
 #include <unordered_set>
 #include <utility>
 #include <vector>
@@ -57,6 +61,9 @@ const char pinyinHanziSep = '!';
 
 constexpr uint32_t pinyinBinaryFormatMagic = 0x000fc613;
 constexpr uint32_t pinyinBinaryFormatVersion = 0x2;
+// Uncompressed trie image after the version, see PinyinDictFormat::Image.
+constexpr uint32_t pinyinImageFormatVersion = 0x3;
+constexpr size_t pinyinImageOffset = sizeof(uint32_t) * 2;
 
 struct PinyinSegmentGraphPathHasher {
     PinyinSegmentGraphPathHasher(const SegmentGraph &graph) : graph_(graph) {}
@@ -191,15 +198,17 @@ inline void searchOneStep(
             }
         } else {
             bool changed = false;
-            for (char test = PinyinEncoder::firstFinal;
-                 test <= PinyinEncoder::lastFinal; test++) {
-                decltype(extraNodes)::value_type p = *iter;
-                const auto resultRaw = p.first->traverseRaw(&test, 1, p.second);
-                if (!PinyinTrie::isNoPathRaw(resultRaw)) {
-                    extraNodes.push_back(p);
-                    changed = true;
-                }
-            }
+            const auto *trie = iter->first;
+            trie->foreachChild(
+                iter->second,
+                [trie, &extraNodes, &changed](uint8_t label,
+                                              PinyinTrie::position_type pos) {
+                    if (PinyinEncoder::isValidFinal(static_cast<char>(label))) {
+                        extraNodes.emplace_back(trie, pos);
+                        changed = true;
+                    }
+                    return true;
+                });
             if (changed) {
                 *iter = extraNodes.back();
                 extraNodes.pop_back();
@@ -229,7 +238,7 @@ size_t fuzzyFactor(PinyinFuzzyFlags flags) {
 }
 
 PinyinDictionary::TrieType loadTextImpl(std::istream &in) {
-    PinyinDictionary::TrieType trie;
+    std::vector<std::pair<std::string, float>> entries;
 
     size_t lineNo = 0;
     std::string lineBuf;
@@ -262,7 +271,8 @@ PinyinDictionary::TrieType loadTextImpl(std::istream &in) {
                     pinyin, PinyinFuzzyFlag::VE_UE);
                 result.push_back(pinyinHanziSep);
                 result.insert(result.end(), hanzi.begin(), hanzi.end());
-                trie.set(result.data(), result.size(), prob);
+                entries.emplace_back(std::string(result.begin(), result.end()),
+                                     prob);
             } catch (const std::invalid_argument &e) {
                 LIBIME_ERROR()
                     << "Skipped line " << lineNo << ", exception: " << e.what();
@@ -272,6 +282,14 @@ PinyinDictionary::TrieType loadTextImpl(std::istream &in) {
             }
         }
     }
+
+    // Stable sort keeps the last duplicated entry winning, like set.
+    std::ranges::stable_sort(entries, std::less<>(),
+                             &std::pair<std::string, float>::first);
+    std::vector<std::pair<std::string_view, float>> sortedEntries(
+        entries.begin(), entries.end());
+    PinyinDictionary::TrieType trie;
+    trie.build(sortedEntries);
     return trie;
 }
 
@@ -292,6 +310,9 @@ PinyinDictionary::TrieType loadBinaryImpl(std::istream &in) {
         readZSTDCompressed(
             in, [&trie](std::istream &compressIn) { trie.load(compressIn); });
         break;
+    case pinyinImageFormatVersion:
+        trie.loadImage(in);
+        break;
     default:
         throw std::invalid_argument("Invalid pinyin version.");
         break;
@@ -299,6 +320,26 @@ PinyinDictionary::TrieType loadBinaryImpl(std::istream &in) {
     return trie;
 }
 
+PinyinDictionary::TrieType loadFileImpl(const char *filename,
+                                        PinyinDictFormat format) {
+    std::ifstream in(filename, std::ios::in | std::ios::binary);
+    throw_if_io_fail(in);
+    if (format != PinyinDictFormat::Text) {
+        // Map the image instead of reading it.
+        uint32_t magic = 0;
+        uint32_t version = 0;
+        if (unmarshall(in, magic) && magic == pinyinBinaryFormatMagic &&
+            unmarshall(in, version) && version == pinyinImageFormatVersion) {
+            PinyinDictionary::TrieType trie;
+            trie.loadImage(filename, pinyinImageOffset);
+            return trie;
+        }
+        in.clear();
+        throw_if_io_fail(in.seekg(0));
+    }
+    return PinyinDictionary::load(in, format);
+}
+
 } // namespace
 
 class PinyinMatchContext {
@@ -339,6 +380,46 @@ public:
     size_t partialLongWordLimit_ = 0;
 };
 
+// Cache of WordIndex of words in trie by the node of the key, see
+// PinyinDictionary::setLanguageModelFile.
+//
+// It is a fixed size table filled on lookup, where a new entry replaces the
+// old one at the same slot. Node positions are only stable while the trie is
+// unchanged, so the cache is cleared whenever the trie changes. Lookup may be
+// called from multiple threads, so an entry is a single atomic word packing
+// the node and its WordIndex.
+class PinyinWordIndexCache {
+public:
+    static constexpr size_t capacity = 16384;
+
+    PinyinWordIndexCache() : entries_(capacity) {}
+
+    WordIndex lookup(const LanguageModel &model, PinyinTrie::position_type pos,
+                     std::string_view hanzi) {
+        // Node of the key, the rest of pos is the offset in tail.
+        const auto node = static_cast<uint32_t>(pos & 0xffffffffULL);
+        // 0 is an empty entry.
+        const uint64_t tag = static_cast<uint64_t>(node) + 1;
+        auto &entry = entries_[node % capacity];
+        const auto value = entry.load(std::memory_order_relaxed);
+        if ((value >> 32) == tag) {
+            return static_cast<WordIndex>(value & 0xffffffffULL);
+        }
+        const WordIndex idx = model.index(hanzi);
+        entry.store((tag << 32) | idx, std::memory_order_relaxed);
+        return idx;
+    }
+
+    void clear() {
+        for (auto &entry : entries_) {
+            entry.store(0, std::memory_order_relaxed);
+        }
+    }
+
+private:
+    std::vector<std::atomic<uint64_t>> entries_;
+};
+
 class PinyinDictionaryPrivate : fcitx::QPtrHolder<PinyinDictionary> {
 public:
     PinyinDictionaryPrivate(PinyinDictionary *q)
@@ -361,10 +442,48 @@ public:
     void matchNode(const PinyinMatchContext &context,
                    const SegmentGraphNode &currentNode) const;
 
+    // Return a callable to look up the WordIndex of a match in trie, which
+    // returns InvalidWordIndex if there is no language model file.
+    auto wordIndexLookup(const PinyinTrie *trie) const {
+        FCITX_Q();
+        PinyinWordIndexCache *cache = nullptr;
+        for (size_t i = 0; model_ && i < wordIndex_.size(); i++) {
+            if (q->trie(i) == trie) {
+                cache = wordIndex_[i].get();
+                break;
+            }
+        }
+        return [cache, model = model_.get()](PinyinTrie::position_type pos,
+                                             std::string_view hanzi) {
+            return cache ? cache->lookup(*model, pos, hanzi)
+                         : InvalidWordIndex;
+        };
+    }
+
+    void resetWordIndex();
+
     fcitx::ScopedConnection conn_;
+    fcitx::ScopedConnection changedConn_;
     std::vector<PinyinDictFlags> flags_;
+    std::shared_ptr<const StaticLanguageModelFile> file_;
+    // Only used to look up WordIndex.
+    std::unique_ptr<LanguageModel> model_;
+    // Cache of each sub dictionary, empty if there is no file.
+    std::vector<std::unique_ptr<PinyinWordIndexCache>> wordIndex_;
 };
 
+void PinyinDictionaryPrivate::resetWordIndex() {
+    FCITX_Q();
+    wordIndex_.clear();
+    if (!model_) {
+        return;
+    }
+    wordIndex_.resize(q->dictSize());
+    for (auto &cache : wordIndex_) {
+        cache = std::make_unique<PinyinWordIndexCache>();
+    }
+}
+
 void PinyinDictionaryPrivate::addEmptyMatch(
     const PinyinMatchContext &context, const SegmentGraphNode &currentNode,
     MatchedPinyinPaths &currentMatches) const {
@@ -429,19 +548,27 @@ PinyinTriePositions traverseAlongPathOneStepBySyllables(
                     updateNext(final.first, fuzzyFactor(final.second), pos);
                 }
             } else if (!path.flags_.test(PinyinDictFlag::FullMatch)) {
-                for (char test = PinyinEncoder::firstFinal;
-                     test <= PinyinEncoder::lastFinal; test++) {
-                    updateNext(static_cast<PinyinFinal>(test), 1, pos);
-                }
+                // Any final, only follow the ones exist in trie.
+                path.trie()->foreachChild(
+                    pos, [fuzzies, &positions](uint8_t label,
+                                               PinyinTrie::position_type next) {
+                        if (PinyinEncoder::isValidFinal(
+                                static_cast<char>(label))) {
+                            positions.emplace_back(next, fuzzies + 1);
+                        }
+                        return true;
+                    });
             }
         }
     }
     return positions;
 }
 
-template <typename T>
-void matchWordsOnTrie(const PinyinTrie *userDict, const MatchedPinyinPath &path,
-                      bool matchLongWord, const T &callback) {
+template <typename WordIndexLookup, typename T>
+void matchWordsOnTrie(const PinyinTrie *userDict,
+                      const WordIndexLookup &wordIndex,
+                      const MatchedPinyinPath &path, bool matchLongWord,
+                      const T &callback) {
     for (const auto &pr : path.triePositions()) {
         uint64_t pos;
         size_t fuzzies;
@@ -452,16 +579,13 @@ void matchWordsOnTrie(const PinyinTrie *userDict, const MatchedPinyinPath &path,
         // After all 10 fuzzies in a word is kinda impossible.
         const bool isCorrection = fuzzies >= PINYIN_CORRECTION_FUZZY_FACTOR;
         if (matchLongWord) {
-            path.trie()->foreach(
-                [userDict, &path, &callback, extraCost, isCorrection](
-                    PinyinTrie::value_type value, size_t len, uint64_t pos) {
-                    std::string s;
-                    s.reserve(len + (path.size() * 2));
-                    path.trie()->suffix(s, len + (path.size() * 2), pos);
+            path.trie()->foreachKey(
+                [userDict, &wordIndex, &path, &callback, extraCost,
+                 isCorrection](PinyinTrie::value_type value,
+                               std::string_view view, uint64_t pos) {
                     if (size_t separator =
-                            s.find(pinyinHanziSep, path.size() * 2);
-                        separator != std::string::npos) {
-                        std::string_view view(s);
+                            view.find(pinyinHanziSep, path.size() * 2);
+                        separator != std::string_view::npos) {
                         auto encodedPinyin = view.substr(0, separator);
                         auto hanzi = view.substr(separator + 1);
                         const size_t lengthDiff =
@@ -473,7 +597,7 @@ void matchWordsOnTrie(const PinyinTrie *userDict, const MatchedPinyinPath &path,
                         }
                         float overLengthCost = fuzzyCost * lengthDiff;
 
-                        callback(encodedPinyin, hanzi,
+                        callback(encodedPinyin, hanzi, wordIndex(pos, hanzi),
                                  value + extraCost + overLengthCost,
                                  isCorrection);
                     }
@@ -487,17 +611,14 @@ void matchWordsOnTrie(const PinyinTrie *userDict, const MatchedPinyinPath &path,
                 continue;
             }
 
-            path.trie()->foreach(
-                [&path, &callback, extraCost, isCorrection](
-                    PinyinTrie::value_type value, size_t len, uint64_t pos) {
-                    std::string s;
-                    s.reserve(len + (path.size() * 2) + 1);
-                    path.trie()->suffix(s, len + (path.size() * 2) + 1, pos);
-                    std::string_view view(s);
+            path.trie()->foreachKey(
+                [&wordIndex, &path, &callback, extraCost,
+                 isCorrection](PinyinTrie::value_type value,
+                               std::string_view view, uint64_t pos) {
                     auto encodedPinyin = view.substr(0, path.size() * 2);
                     auto hanzi = view.substr((path.size() * 2) + 1);
-                    callback(encodedPinyin, hanzi, value + extraCost,
-                             isCorrection);
+                    callback(encodedPinyin, hanzi, wordIndex(pos, hanzi),
+                             value + extraCost, isCorrection);
                     return true;
                 },
                 pos);
@@ -511,6 +632,7 @@ bool PinyinDictionaryPrivate::matchWordsForOnePath(
     bool matched = false;
     assert(path.path_.size() >= 2);
     const SegmentGraphNode &prevNode = *path.path_[path.path_.size() - 2];
+    const auto wordIndex = wordIndexLookup(path.trie());
 
     if (path.flags_.test(PinyinDictFlag::FullMatch) &&
         (path.path_.front() != &context.graph_.start() ||
@@ -551,10 +673,11 @@ bool PinyinDictionaryPrivate::matchWordsForOnePath(
 
             auto &items = *result;
             matchWordsOnTrie(
-                q->trie(PinyinDictionary::UserDict), path, matchLongWordEnabled,
+                q->trie(PinyinDictionary::UserDict), wordIndex, path,
+                matchLongWordEnabled,
                 [&items](std::string_view encodedPinyin, std::string_view hanzi,
-                         float cost, bool isCorrection) {
-                    items.emplace_back(hanzi, cost, encodedPinyin,
+                         WordIndex idx, float cost, bool isCorrection) {
+                    items.emplace_back(hanzi, idx, cost, encodedPinyin,
                                        isCorrection);
                 });
         }
@@ -568,11 +691,11 @@ bool PinyinDictionaryPrivate::matchWordsForOnePath(
         }
     } else {
         matchWordsOnTrie(
-            q->trie(PinyinDictionary::UserDict), path, matchLongWord,
+            q->trie(PinyinDictionary::UserDict), wordIndex, path, matchLongWord,
             [&foundOneWord](std::string_view encodedPinyin,
-                            std::string_view hanzi, float cost,
+                            std::string_view hanzi, WordIndex idx, float cost,
                             bool isCorrection) {
-                WordNode word(hanzi, InvalidWordIndex);
+                WordNode word(hanzi, idx);
                 foundOneWord(encodedPinyin, word, cost, isCorrection);
             });
     }
@@ -775,13 +898,9 @@ void PinyinDictionary::matchWords(const char *data, size_t size,
     }
 
     for (auto &node : nodes) {
-        node.first->foreach(
-            [&node, &callback, size](PinyinTrie::value_type value, size_t len,
-                                     uint64_t pos) {
-                std::string s;
-                node.first->suffix(s, len + size + 1, pos);
-
-                auto view = std::string_view(s);
+        node.first->foreachKey(
+            [&callback, size](PinyinTrie::value_type value,
+                              std::string_view view, uint64_t /*pos*/) {
                 return callback(view.substr(0, size), view.substr(size + 1),
                                 value);
             },
@@ -809,13 +928,9 @@ void PinyinDictionary::matchWordsPrefix(const char *data, size_t size,
     }
 
     for (auto &node : nodes) {
-        node.first->foreach(
-            [&node, &callback, size](PinyinTrie::value_type value, size_t len,
-                                     uint64_t pos) {
-                std::string s;
-                node.first->suffix(s, len + size, pos);
-
-                std::string_view view(s);
+        node.first->foreachKey(
+            [&callback, size](PinyinTrie::value_type value,
+                              std::string_view view, uint64_t /*pos*/) {
                 if (auto sep = view.find(pinyinHanziSep, size);
                     sep != std::string::npos) {
                     return callback(view.substr(0, sep), view.substr(sep + 1),
@@ -833,7 +948,23 @@ PinyinDictionary::PinyinDictionary()
     d->conn_ = connect<TrieDictionary::dictSizeChanged>([this](size_t size) {
         FCITX_D();
         d->flags_.resize(size);
+        if (!d->model_) {
+            return;
+        }
+        // Only the added sub dictionaries need a new cache.
+        const auto oldSize = d->wordIndex_.size();
+        d->wordIndex_.resize(size);
+        for (size_t i = oldSize; i < size; i++) {
+            d->wordIndex_[i] = std::make_unique<PinyinWordIndexCache>();
+        }
     });
+    d->changedConn_ =
+        connect<TrieDictionary::dictionaryChanged>([this](size_t idx) {
+            FCITX_D();
+            if (idx < d->wordIndex_.size()) {
+                d->wordIndex_[idx]->clear();
+            }
+        });
     d->flags_.resize(dictSize());
 }
 
@@ -841,9 +972,7 @@ PinyinDictionary::~PinyinDictionary() {}
 
 void PinyinDictionary::load(size_t idx, const char *filename,
                             PinyinDictFormat format) {
-    std::ifstream in(filename, std::ios::in | std::ios::binary);
-    throw_if_io_fail(in);
-    load(idx, in, format);
+    setTrie(idx, loadFileImpl(filename, format));
 }
 
 void PinyinDictionary::load(size_t idx, std::istream &in,
@@ -857,18 +986,27 @@ PinyinDictionary::TrieType PinyinDictionary::load(std::istream &in,
     case PinyinDictFormat::Text:
         return loadTextImpl(in);
     case PinyinDictFormat::Binary:
+    case PinyinDictFormat::Image:
         return loadBinaryImpl(in);
     default:
         throw std::invalid_argument("invalid format type");
     }
 }
 
+std::future<PinyinDictionary::TrieType>
+PinyinDictionary::loadAsync(const char *filename, PinyinDictFormat format) {
+    return std::async(std::launch::async,
+                      [filename = std::string(filename), format]() {
+                          return loadFileImpl(filename.data(), format);
+                      });
+}
+
 void PinyinDictionary::loadText(size_t idx, std::istream &in) {
-    *mutableTrie(idx) = loadTextImpl(in);
+    setTrie(idx, loadTextImpl(in));
 }
 
 void PinyinDictionary::loadBinary(size_t idx, std::istream &in) {
-    *mutableTrie(idx) = loadBinaryImpl(in);
+    setTrie(idx, loadBinaryImpl(in));
 }
 
 void PinyinDictionary::save(size_t idx, const char *filename,
@@ -892,6 +1030,11 @@ void PinyinDictionary::save(size_t idx, std::ostream &out,
             mutableTrie(idx)->save(compressOut);
         });
     } break;
+    case PinyinDictFormat::Image:
+        throw_if_io_fail(marshall(out, pinyinBinaryFormatMagic));
+        throw_if_io_fail(marshall(out, pinyinImageFormatVersion));
+        mutableTrie(idx)->saveImage(out);
+        break;
     default:
         throw std::invalid_argument("invalid format type");
     }
@@ -952,6 +1095,27 @@ bool PinyinDictionary::removeWord(size_t idx, std::string_view fullPinyin,
         idx, std::string_view(result.data(), result.size()));
 }
 
+void PinyinDictionary::setLanguageModelFile(
+    std::shared_ptr<const StaticLanguageModelFile> file) {
+    FCITX_D();
+    if (d->file_ == file) {
+        return;
+    }
+    d->file_ = std::move(file);
+    d->model_ = d->file_ ? std::make_unique<LanguageModel>(d->file_) : nullptr;
+    d->resetWordIndex();
+    // Words matched before carry the WordIndex of the old file.
+    for (size_t i = 0; i < dictSize(); i++) {
+        emit<PinyinDictionary::dictionaryChanged>(i);
+    }
+}
+
+const std::shared_ptr<const StaticLanguageModelFile> &
+PinyinDictionary::languageModelFile() const {
+    FCITX_D();
+    return d->file_;
+}
+
 void PinyinDictionary::setFlags(size_t idx, PinyinDictFlags flags) {
     FCITX_D();
     if (idx >= dictSize()) {
@@ -8,6 +8,7 @@
 
 #include <cstddef>
 #include <functional>
+#include <future>
 #include <istream>
 #include <memory>
 #include <optional>
@@ -17,6 +18,7 @@
 #include <fcitx-utils/flags.h>
 #include <fcitx-utils/macros.h>
 #include <libime/core/dictionary.h>
+#include <libime/core/languagemodel.h>
 #include <libime/core/segmentgraph.h>
 #include <libime/core/triedictionary.h>
 #include <libime/pinyin/libimepinyin_export.h>
@@ -24,7 +26,18 @@
 
 namespace libime {
 
-enum class PinyinDictFormat { Text, Binary };
+enum class PinyinDictFormat {
+    Text,
+    Binary,
+    /**
+     * Uncompressed binary format that is mapped into memory when it is
+     * loaded from a file, so all processes loading the same file share the
+     * memory. It can be loaded with either Binary or Image.
+     *
+     * @since 1.1.16
+     */
+    Image
+};
 
 class PinyinDictionaryPrivate;
 
@@ -60,6 +73,7 @@ public:
 
     // Load dicitonary for a specific dict.
     void load(size_t idx, std::istream &in, PinyinDictFormat format);
+    // Load dicitonary for a specific dict, the Image format is mapped.
     void load(size_t idx, const char *filename, PinyinDictFormat format);
 
     // Match the word by encoded pinyin.
@@ -81,6 +95,33 @@ public:
 
     void setFlags(size_t idx, PinyinDictFlags flags);
 
+    /**
+     * Resolve the WordIndex of words with the language model file.
+     *
+     * Words matched from the dictionary then carry the WordIndex of the
+     * language model using this file, so decoder does not need to look them
+     * up in the vocabulary. Each sub dictionary has a fixed size cache from
+     * the trie node of a word to its WordIndex, which is filled when the word
+     * is matched and cleared when the sub dictionary changes.
+     *
+     * The dictionary should only be decoded with the language model of the
+     * same file when it is set. Set to nullptr to disable it. Changing the
+     * file emits dictionaryChanged for every sub dictionary, since the words
+     * matched before carry the WordIndex of the old file. A Lattice decoded
+     * before still has them, so it needs to be cleared, e.g. with
+     * PinyinContext::clear.
+     *
+     * @since 1.1.16
+     */
+    void
+    setLanguageModelFile(std::shared_ptr<const StaticLanguageModelFile> file);
+    /**
+     * @see setLanguageModelFile
+     * @since 1.1.16
+     */
+    const std::shared_ptr<const StaticLanguageModelFile> &
+    languageModelFile() const;
+
     /**
      * Load text format into the Trie
      *
@@ -91,6 +132,20 @@ public:
      */
     static TrieType load(std::istream &in, PinyinDictFormat format);
 
+    /**
+     * Load the file into the Trie on a new thread.
+     *
+     * The dictionary stays usable while loading, set the result with setTrie
+     * when it is ready. Errors in loading are thrown by the future.
+     *
+     * @param filename file name
+     * @param format dict format.
+     * @see TrieDictionary::setTrie
+     * @since 1.1.16
+     */
+    static std::future<TrieType> loadAsync(const char *filename,
+                                           PinyinDictFormat format);
+
     using dictionaryChanged = TrieDictionary::dictionaryChanged;
 
 protected:
@@ -4,6 +4,7 @@
  * SPDX-License-Identifier: LGPL-2.1-or-later
  */
 #include "pinyinime.h"
+#include <chrono>
 #include <cstddef>
 #include <limits>
 #include <memory>
@@ -28,6 +29,8 @@ public:
         : fcitx::QPtrHolder<PinyinIME>(q), dict_(std::move(dict)),
           model_(std::move(model)),
           decoder_(std::make_unique<PinyinDecoder>(dict_.get(), model_.get())) {
+        // The dictionary is only used with this model.
+        dict_->setLanguageModelFile(model_->languageModelFile());
         model_->setCodeExtractor([](const WordNode *node) -> std::string {
             if (const auto *pinyinNode =
                     dynamic_cast<const PinyinLatticeNode *>(node)) {
@@ -54,6 +57,7 @@ public:
     size_t frameSize_ = Decoder::frameSizeDefault;
     size_t partialLongWordLimit_ = 0;
     size_t wordCandidateLimit_ = 15;
+    std::chrono::microseconds decodeTimeLimit_{0};
     float maxDistance_ = std::numeric_limits<float>::max();
     float minPath_ = -std::numeric_limits<float>::max();
     PinyinPreeditMode preeditMode_ = PinyinPreeditMode::RawText;
@@ -167,6 +171,32 @@ void PinyinIME::setWordCandidateLimit(size_t n) {
     }
 }
 
+std::chrono::microseconds PinyinIME::decodeTimeLimit() const {
+    FCITX_D();
+    return d->decodeTimeLimit_;
+}
+
+void PinyinIME::setDecodeTimeLimit(std::chrono::microseconds limit) {
+    FCITX_D();
+    if (d->decodeTimeLimit_ != limit) {
+        d->decodeTimeLimit_ = limit;
+        emit<PinyinIME::optionChanged>();
+    }
+}
+
+bool PinyinIME::partialSort() const {
+    FCITX_D();
+    return d->decoder_->partialSort();
+}
+
+void PinyinIME::setPartialSort(bool partialSort) {
+    FCITX_D();
+    if (d->decoder_->partialSort() != partialSort) {
+        d->decoder_->setPartialSort(partialSort);
+        emit<PinyinIME::optionChanged>();
+    }
+}
+
 void PinyinIME::setPreeditMode(PinyinPreeditMode mode) {
     FCITX_D();
     if (d->preeditMode_ != mode) {
@@ -6,6 +6,7 @@
 #ifndef _FCITX_LIBIME_PINYIN_PINYINIME_H_
 #define _FCITX_LIBIME_PINYIN_PINYINIME_H_
 
+#include <chrono>
 #include <cstddef>
 #include <limits>
 #include <memory>
@@ -57,6 +58,39 @@ public:
      * Since 1.1.12
      */
     void setWordCandidateLimit(size_t n);
+    /**
+     * \brief The time limit of decoding on each update of PinyinContext.
+     *
+     * When the limit is reached, the rest of decoding uses smaller beam and
+     * frame size, and only the best sentence is searched.
+     *
+     * When is 0, it means no limit.
+     *
+     * Since 1.1.16
+     */
+    std::chrono::microseconds decodeTimeLimit() const;
+    /**
+     * \brief Set the time limit of decoding.
+     * Since 1.1.16
+     */
+    void setDecodeTimeLimit(std::chrono::microseconds limit);
+    /**
+     * \brief Whether the decoder only sorts the best nodes of lattice.
+     *
+     * Off by default. PinyinContext only depends on the order of the best
+     * node ending at each segment, so it can be turned on to save the time
+     * of sorting the rest.
+     *
+     * @see Decoder::setPartialSort
+     *
+     * Since 1.1.16
+     */
+    bool partialSort() const;
+    /**
+     * \brief Set whether the decoder only sorts the best nodes of lattice.
+     * Since 1.1.16
+     */
+    void setPartialSort(bool partialSort);
     void setScoreFilter(float maxDistance = std::numeric_limits<float>::max(),
                         float minPath = -std::numeric_limits<float>::max());
     void setShuangpinProfile(std::shared_ptr<const ShuangpinProfile> profile);
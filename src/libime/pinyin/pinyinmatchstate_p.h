@@ -44,9 +44,9 @@ struct MatchedPinyinTrieNodes {
 // A cache to store the matched word, encoded Full Pinyin for this word and the
 // adjustment score.
 struct PinyinMatchResult {
-    PinyinMatchResult(std::string_view s, float value,
+    PinyinMatchResult(std::string_view s, WordIndex idx, float value,
                       std::string_view encodedPinyin, bool isCorrection)
-        : word_(s, InvalidWordIndex), value_(value),
+        : word_(s, idx), value_(value),
           encodedPinyin_(encodedPinyin), isCorrection_(isCorrection) {}
     WordNode word_;
     float value_ = 0.0F;
@@ -13,6 +13,7 @@
 #include <cstring>
 #include <exception>
 #include <fstream>
+#include <future>
 #include <ios>
 #include <iostream>
 #include <istream>
@@ -22,10 +23,12 @@
 #include <ostream>
 #include <ranges>
 #include <set>
+#include <sstream>
 #include <stdexcept>
 #include <string>
 #include <string_view>
 #include <tuple>
+#include <type_traits>
 #include <unordered_set>
 #include <utility>
 #include <vector>
@@ -57,6 +60,8 @@ constexpr char keyValueSeparatorString[] = {keyValueSeparator, '\0'};
 // "fc" t"ab"l"e"
 constexpr uint32_t tableBinaryFormatMagic = 0x000fcabe;
 constexpr uint32_t tableBinaryFormatVersion = 0x2;
+// Uncompressed header and trie images, see TableFormat::Image.
+constexpr uint32_t tableImageFormatVersion = 0x3;
 constexpr uint32_t userTableBinaryFormatMagic = 0x356fcabe;
 constexpr uint32_t userTableBinaryFormatVersion = 0x3;
 constexpr uint32_t extraTableBinaryFormatMagic = 0x6b0fcabe;
@@ -100,6 +105,27 @@ inline std::string generateTableEntry(uint32_t pinyinKey, std::string_view key,
                                       keyValueSeparatorString, value);
 }
 
+// Advance position by one character in codes. It follows the bytes exist in
+// trie instead of trying every code.
+void traverseAnyCode(const DATrie<uint32_t> &trie,
+                     DATrie<uint32_t>::position_type position,
+                     const std::set<uint32_t> &codes, std::string &chr,
+                     std::vector<DATrie<uint32_t>::position_type> &result) {
+    trie.foreachChild(position, [&trie, &codes, &chr, &result](
+                                    uint8_t label,
+                                    DATrie<uint32_t>::position_type next) {
+        chr.push_back(static_cast<char>(label));
+        const auto code = fcitx::utf8::getChar(chr);
+        if (code == fcitx::utf8::NOT_ENOUGH_SPACE) {
+            traverseAnyCode(trie, next, codes, chr, result);
+        } else if (fcitx::utf8::isValidChar(code) && codes.contains(code)) {
+            result.push_back(next);
+        }
+        chr.pop_back();
+        return true;
+    });
+}
+
 void maybeUnescapeValue(std::string &value) {
     if (auto unescape = fcitx::stringutils::unescapeForValue(value)) {
         value = unescape.value();
@@ -276,6 +302,8 @@ bool TableBasedDictionaryPrivate::matchTrie(
     auto range = fcitx::utf8::MakeUTF8CharRange(code);
     std::vector<DATrie<uint32_t>::position_type> positions;
     positions.push_back(0);
+    // Scratch buffer for the matching key, reused by traverseAnyCode.
+    std::string anyCodeBuffer;
     // BFS on trie.
     for (auto iter = std::begin(range), end = std::end(range); iter != end;
          iter++) {
@@ -284,14 +312,8 @@ bool TableBasedDictionaryPrivate::matchTrie(
         for (auto position : positions) {
             if (flag != PhraseFlag::Pinyin && *iter == options_.matchingKey() &&
                 options_.matchingKey()) {
-                for (auto code : inputCode_) {
-                    auto curPos = position;
-                    auto strCode = fcitx::utf8::UCS4ToUTF8(code);
-                    auto result = trie.traverse(strCode, curPos);
-                    if (!DATrie<unsigned int>::isNoPath(result)) {
-                        newPositions.push_back(curPos);
-                    }
-                }
+                traverseAnyCode(trie, position, inputCode_, anyCodeBuffer,
+                                newPositions);
             } else {
                 auto charRange = iter.charRange();
                 std::string_view chr(
@@ -308,17 +330,14 @@ bool TableBasedDictionaryPrivate::matchTrie(
         positions = std::move(newPositions);
     }
 
-    auto matchWord = [&trie, &code, &callback, flag, mode,
-                      indexOffset](uint32_t value, size_t len,
-                                   DATrie<int32_t>::position_type pos) {
-        std::string entry;
-        trie.suffix(entry, code.size() + len, pos);
-        auto sep = entry.find(keyValueSeparator, code.size());
-        if (sep == std::string::npos) {
+    auto matchWord = [&code, &callback, flag, mode,
+                      indexOffset](uint32_t value, std::string_view view,
+                                   DATrie<uint32_t>::position_type /*pos*/) {
+        auto sep = view.find(keyValueSeparator, code.size());
+        if (sep == std::string_view::npos) {
             return true;
         }
 
-        auto view = std::string_view(entry);
         auto matchedCode = view.substr(0, sep);
         if (mode == TableMatchMode::Prefix ||
             (mode == TableMatchMode::Exact &&
@@ -335,7 +354,7 @@ bool TableBasedDictionaryPrivate::matchTrie(
     };
 
     for (auto position : positions) {
-        if (!trie.foreach(matchWord, position)) {
+        if (!trie.foreachKey(matchWord, position)) {
             return false;
         }
     }
@@ -560,8 +579,37 @@ bool TableBasedDictionaryPrivate::hasExactMatchInPhraseTrie(
                        });
 }
 
-void TableBasedDictionaryPrivate::loadBinary(std::istream &in) {
-    FCITX_Q();
+std::vector<std::string> TableBasedDictionaryPrivate::constructPhraseCodes(
+    std::string_view value) const {
+    std::vector<std::string> codes;
+    for (auto iter = value.begin(); iter != value.end();) {
+        auto next = fcitx::utf8::nextChar(iter);
+        codes.emplace_back(iter, next).push_back(keyValueSeparator);
+        iter = next;
+    }
+    // Characters are looked up together, so the cache misses overlap.
+    std::vector<std::string_view> keys(codes.begin(), codes.end());
+    std::vector<DATrie<int32_t>::position_type> positions(keys.size());
+    std::vector<int32_t> results(keys.size());
+    singleCharConstTrie_.traverseBatch(keys, positions, results);
+    for (size_t i = 0; i < codes.size(); i++) {
+        auto &code = codes[i];
+        code.clear();
+        if (DATrie<int32_t>::isNoPath(results[i])) {
+            continue;
+        }
+        singleCharConstTrie_.foreach(
+            [this, &code](int32_t, size_t len,
+                          DATrie<int32_t>::position_type pos) {
+                singleCharConstTrie_.suffix(code, len, pos);
+                return false;
+            },
+            positions[i]);
+    }
+    return codes;
+}
+
+void TableBasedDictionaryPrivate::loadBinaryHeader(std::istream &in) {
     throw_if_io_fail(unmarshall(in, pinyinKey_));
     throw_if_io_fail(unmarshall(in, promptKey_));
     throw_if_io_fail(unmarshall(in, phraseKey_));
@@ -589,18 +637,79 @@ void TableBasedDictionaryPrivate::loadBinary(std::istream &in) {
     while (size--) {
         rules_.emplace_back(in);
     }
-    phraseTrie_ = decltype(phraseTrie_)(in);
-    phraseTrieIndex_ = maxValue(phraseTrie_);
-    singleCharTrie_ = decltype(singleCharTrie_)(in);
+}
+
+void TableBasedDictionaryPrivate::saveBinaryHeader(std::ostream &out) const {
+    throw_if_io_fail(marshall(out, pinyinKey_));
+    throw_if_io_fail(marshall(out, promptKey_));
+    throw_if_io_fail(marshall(out, phraseKey_));
+    throw_if_io_fail(marshall(out, codeLength_));
+    throw_if_io_fail(marshall(out, static_cast<uint32_t>(inputCode_.size())));
+    for (auto c : inputCode_) {
+        throw_if_io_fail(marshall(out, c));
+    }
+    throw_if_io_fail(
+        marshall(out, static_cast<uint32_t>(ignoreChars_.size())));
+    for (auto c : ignoreChars_) {
+        throw_if_io_fail(marshall(out, c));
+    }
+    throw_if_io_fail(marshall(out, static_cast<uint32_t>(rules_.size())));
+    for (const auto &rule : rules_) {
+        throw_if_io_fail(out << rule);
+    }
+}
+
+template <typename Callback>
+void TableBasedDictionaryPrivate::foreachBinaryTrie(Callback callback) {
+    FCITX_Q();
+    callback(phraseTrie_);
+    callback(singleCharTrie_);
     if (q->hasRule()) {
-        singleCharConstTrie_ = decltype(singleCharConstTrie_)(in);
-        singleCharLookupTrie_ = decltype(singleCharLookupTrie_)(in);
+        callback(singleCharConstTrie_);
+        callback(singleCharLookupTrie_);
     }
     if (promptKey_) {
-        promptTrie_ = decltype(promptTrie_)(in);
+        callback(promptTrie_);
     }
 }
 
+void TableBasedDictionaryPrivate::loadBinary(std::istream &in) {
+    loadBinaryHeader(in);
+    foreachBinaryTrie(
+        [&in](auto &trie) { trie = std::decay_t<decltype(trie)>(in); });
+    phraseTrieIndex_ = maxValue(phraseTrie_);
+}
+
+size_t TableBasedDictionaryPrivate::loadImageHeader(std::istream &in) {
+    uint32_t size = 0;
+    throw_if_io_fail(unmarshall(in, size));
+    std::string header(size, '\0');
+    throw_if_io_fail(in.read(header.data(), header.size()));
+    std::istringstream headerIn(header);
+    loadBinaryHeader(headerIn);
+    // Magic, version and size are before the header, and the first trie
+    // image starts at the next multiple of 8.
+    const size_t headerEnd = sizeof(uint32_t) * 3 + size;
+    const size_t offset = (headerEnd + 7) / 8 * 8;
+    throw_if_io_fail(in.ignore(offset - headerEnd));
+    return offset;
+}
+
+void TableBasedDictionaryPrivate::loadImage(std::istream &in) {
+    loadImageHeader(in);
+    foreachBinaryTrie([&in](auto &trie) { trie.loadImage(in); });
+    phraseTrieIndex_ = maxValue(phraseTrie_);
+}
+
+void TableBasedDictionaryPrivate::mapImage(const char *filename,
+                                           std::istream &in) {
+    auto offset = loadImageHeader(in);
+    foreachBinaryTrie([filename, &offset](auto &trie) {
+        offset = trie.loadImage(filename, offset);
+    });
+    phraseTrieIndex_ = maxValue(phraseTrie_);
+}
+
 void TableBasedDictionaryPrivate::loadUserBinary(std::istream &in,
                                                  uint32_t version) {
     userTrie_ = decltype(userTrie_)(in);
@@ -623,14 +732,38 @@ TableBasedDictionary::TableBasedDictionary()
 TableBasedDictionary::~TableBasedDictionary() = default;
 
 void TableBasedDictionary::load(const char *filename, TableFormat format) {
+    FCITX_D();
     std::ifstream in(filename, std::ios::in | std::ios::binary);
     throw_if_io_fail(in);
+    if (format != TableFormat::Text) {
+        // Map the trie images instead of reading them.
+        uint32_t magic = 0;
+        uint32_t version = 0;
+        if (unmarshall(in, magic) && magic == tableBinaryFormatMagic &&
+            unmarshall(in, version) && version == tableImageFormatVersion) {
+            d->mapImage(filename, in);
+            return;
+        }
+        in.clear();
+        throw_if_io_fail(in.seekg(0));
+    }
     load(in, format);
 }
 
+std::future<std::unique_ptr<TableBasedDictionary>>
+TableBasedDictionary::loadAsync(const char *filename, TableFormat format) {
+    return std::async(std::launch::async,
+                      [filename = std::string(filename), format]() {
+                          auto dict = std::make_unique<TableBasedDictionary>();
+                          dict->load(filename.data(), format);
+                          return dict;
+                      });
+}
+
 void TableBasedDictionary::load(std::istream &in, TableFormat format) {
     switch (format) {
     case TableFormat::Binary:
+    case TableFormat::Image:
         loadBinary(in);
         break;
     case TableFormat::Text:
@@ -850,6 +983,9 @@ void TableBasedDictionary::loadBinary(std::istream &in) {
         readZSTDCompressed(
             in, [d](std::istream &compressIn) { d->loadBinary(compressIn); });
         break;
+    case tableImageFormatVersion:
+        d->loadImage(in);
+        break;
 
     default:
         throw std::invalid_argument("Invalid table version.");
@@ -870,6 +1006,9 @@ void TableBasedDictionary::save(std::ostream &out, TableFormat format) {
     case TableFormat::Text:
         saveText(out);
         break;
+    case TableFormat::Image:
+        saveImage(out);
+        break;
     default:
         throw std::invalid_argument("unknown format type");
     }
@@ -881,37 +1020,27 @@ void TableBasedDictionary::saveBinary(std::ostream &origOut) {
 
     writeZSTDCompressed(origOut, [this](std::ostream &out) {
         FCITX_D();
-        throw_if_io_fail(marshall(out, d->pinyinKey_));
-        throw_if_io_fail(marshall(out, d->promptKey_));
-        throw_if_io_fail(marshall(out, d->phraseKey_));
-        throw_if_io_fail(marshall(out, d->codeLength_));
-        throw_if_io_fail(
-            marshall(out, static_cast<uint32_t>(d->inputCode_.size())));
-        for (auto c : d->inputCode_) {
-            throw_if_io_fail(marshall(out, c));
-        }
-        throw_if_io_fail(
-            marshall(out, static_cast<uint32_t>(d->ignoreChars_.size())));
-        for (auto c : d->ignoreChars_) {
-            throw_if_io_fail(marshall(out, c));
-        }
-        throw_if_io_fail(
-            marshall(out, static_cast<uint32_t>(d->rules_.size())));
-        for (const auto &rule : d->rules_) {
-            throw_if_io_fail(out << rule);
-        }
-        d->phraseTrie_.save(out);
-        d->singleCharTrie_.save(out);
-        if (hasRule()) {
-            d->singleCharConstTrie_.save(out);
-            d->singleCharLookupTrie_.save(out);
-        }
-        if (d->promptKey_) {
-            d->promptTrie_.save(out);
-        }
+        d->saveBinaryHeader(out);
+        d->foreachBinaryTrie([&out](auto &trie) { trie.save(out); });
     });
 }
 
+void TableBasedDictionary::saveImage(std::ostream &out) {
+    FCITX_D();
+    throw_if_io_fail(marshall(out, tableBinaryFormatMagic));
+    throw_if_io_fail(marshall(out, tableImageFormatVersion));
+    std::ostringstream header;
+    d->saveBinaryHeader(header);
+    const auto headerData = header.str();
+    throw_if_io_fail(marshall(out, static_cast<uint32_t>(headerData.size())));
+    throw_if_io_fail(out.write(headerData.data(), headerData.size()));
+    // Pad to the offset of the first trie image, see loadImageHeader.
+    static constexpr char padding[8] = {};
+    const size_t headerEnd = sizeof(uint32_t) * 3 + headerData.size();
+    throw_if_io_fail(out.write(padding, (8 - headerEnd % 8) % 8));
+    d->foreachBinaryTrie([&out](auto &trie) { trie.saveImage(out); });
+}
+
 void TableBasedDictionary::loadUser(const char *filename, TableFormat format) {
     std::ifstream in(filename, std::ios::in | std::ios::binary);
     throw_if_io_fail(in);
@@ -1309,6 +1438,8 @@ bool TableBasedDictionary::generateWithHint(
     hints.resize(valueLen);
 
     std::string newKey;
+    // Looked up on first use and shared by all rules.
+    std::optional<std::vector<std::string>> codes;
     for (const auto &rule : d->rules_) {
         // check rule can be applied
         const bool canApplyRule =
@@ -1330,7 +1461,6 @@ bool TableBasedDictionary::generateWithHint(
         bool success = true;
         std::set<std::pair<size_t, int>> usedChar;
         for (const auto &ruleEntry : rule.entries()) {
-            std::string_view::const_iterator iter;
             // skip rule entry like p00.
             if (ruleEntry.isPlaceHolder()) {
                 continue;
@@ -1347,16 +1477,15 @@ bool TableBasedDictionary::generateWithHint(
             } else {
                 index = valueLen - ruleEntry.character();
             }
-            iter = fcitx::utf8::nextNChar(value.begin(), index);
-            std::string_view::iterator prev = iter;
-            iter = fcitx::utf8::nextChar(iter);
-            std::string_view chr(&*prev, std::distance(prev, iter));
 
             std::string entry;
             if (!hints[index].empty()) {
                 entry = hints[index];
             } else {
-                entry = reverseLookup(chr, PhraseFlag::ConstructPhrase);
+                if (!codes) {
+                    codes = d->constructPhraseCodes(value);
+                }
+                entry = (*codes)[index];
             }
             if (entry.empty()) {
                 success = false;
@@ -11,6 +11,7 @@
 #include <cstddef>
 #include <cstdint>
 #include <functional>
+#include <future>
 #include <istream>
 #include <memory>
 #include <ostream>
@@ -42,7 +43,20 @@ enum class PhraseFlag {
 using TableMatchCallback = std::function<bool(
     std::string_view, std::string_view, uint32_t, PhraseFlag)>;
 
-enum class TableFormat { Text, Binary };
+enum class TableFormat {
+    Text,
+    Binary,
+    /**
+     * Uncompressed binary format whose tries are mapped into memory when it
+     * is loaded from a file, so all processes loading the same table share
+     * the memory. It can be loaded with either Binary or Image.
+     *
+     * Only the main dictionary supports this format.
+     *
+     * @since 1.1.16
+     */
+    Image
+};
 enum class TableMatchMode { Exact, Prefix };
 
 class TableRule;
@@ -60,6 +74,16 @@ public:
 
     void load(const char *filename, TableFormat format = TableFormat::Binary);
     void load(std::istream &in, TableFormat format = TableFormat::Binary);
+    /**
+     * Load the file into a new dictionary on a new thread.
+     *
+     * The current dictionary can be used until the new one is ready. Errors
+     * in loading are thrown by the future.
+     *
+     * @since 1.1.16
+     */
+    static std::future<std::unique_ptr<TableBasedDictionary>>
+    loadAsync(const char *filename, TableFormat format = TableFormat::Binary);
     void save(const char *filename, TableFormat format = TableFormat::Binary);
     void save(std::ostream &out, TableFormat format = TableFormat::Binary);
 
@@ -128,6 +152,7 @@ private:
     void loadBinary(std::istream &in);
     void saveText(std::ostream &out);
     void saveBinary(std::ostream &origOut);
+    void saveImage(std::ostream &out);
 
     void
     matchPrefixImpl(const SegmentGraph &graph,
@@ -7,8 +7,10 @@
 #ifndef _LIBIME_LIBIME_TABLE_TABLEBASEDDICTIONARY_P_H_
 #define _LIBIME_LIBIME_TABLE_TABLEBASEDDICTIONARY_P_H_
 
+#include <cstddef>
 #include <cstdint>
 #include <istream>
+#include <ostream>
 #include <optional>
 #include <regex>
 #include <set>
@@ -77,7 +79,16 @@ public:
     void reset();
     bool validate() const;
 
+    void loadBinaryHeader(std::istream &in);
+    void saveBinaryHeader(std::ostream &out) const;
+    // Call callback with each trie saved in the binary format, in order.
+    template <typename Callback>
+    void foreachBinaryTrie(Callback callback);
     void loadBinary(std::istream &in);
+    // Load the header of image format, and return the offset of first trie.
+    size_t loadImageHeader(std::istream &in);
+    void loadImage(std::istream &in);
+    void mapImage(const char *filename, std::istream &in);
     void loadUserBinary(std::istream &in, uint32_t version);
 
     bool validateKeyValue(std::string_view key, std::string_view value,
@@ -95,6 +106,11 @@ public:
                        const TableRule &rule) const;
 
     bool hasExactMatchInPhraseTrie(std::string_view entry) const;
+
+    // Code of each character in value for constructing phrase, or empty if
+    // there is none.
+    std::vector<std::string>
+    constructPhraseCodes(std::string_view value) const;
 };
 
 } // namespace libime
@@ -325,6 +325,7 @@ public:
     UserLanguageModel &model_;
     TableDecoder decoder_;
     Lattice lattice_;
+    DecodeStats decodeStats_;
     SegmentGraph graph_;
     std::vector<SentenceResult> candidates_;
     std::vector<std::vector<SelectedCode>> selected_;
@@ -469,6 +470,11 @@ void TableContext::setAutoSelectIndex(size_t index) {
     d->autoSelectIndex_ = index;
 }
 
+const DecodeStats &TableContext::decodeStats() const {
+    FCITX_D();
+    return d->decodeStats_;
+}
+
 void TableContext::autoSelect() {
     FCITX_D();
     if (selected()) {
@@ -528,20 +534,26 @@ void TableContext::update() {
         !d->dict_.tableOptions().autoRuleSet().empty()) {
         nbest = 5;
     }
+    DecodeOptions options;
+    options.stats = &d->decodeStats_;
     if (d->decoder_.decode(d->lattice_, d->graph_, nbest, state, max, min,
-                           beamSize, frameSize)) {
+                           beamSize, frameSize, nullptr, options)) {
         t1 = std::chrono::high_resolution_clock::now();
         LIBIME_TABLE_DEBUG()
             << "Decode: "
             << std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0)
                    .count();
         t0 = t1;
-        std::unordered_map<std::string, size_t> dup;
+        // Index of candidates, by the hash of their text.
+        std::unordered_multimap<size_t, size_t> dup;
 
         auto insertCandidate = [d, &dup](SentenceResult sentence) {
-            auto sentenceString = sentence.toString();
-            auto iter = dup.find(sentenceString);
-            if (iter != dup.end()) {
+            const auto hash = sentence.textHash();
+            auto [begin, end] = dup.equal_range(hash);
+            auto iter = std::find_if(begin, end, [d, &sentence](auto &item) {
+                return d->candidates_[item.second].textEquals(sentence);
+            });
+            if (iter != end) {
                 auto idx = iter->second;
                 if (shouldReplaceCandidate(
                         d->candidates_[idx], sentence,
@@ -549,8 +561,8 @@ void TableContext::update() {
                     d->candidates_[idx] = std::move(sentence);
                 }
             } else {
+                dup.emplace(hash, d->candidates_.size());
                 d->candidates_.emplace_back(std::move(sentence));
-                dup[sentenceString] = d->candidates_.size() - 1;
             }
         };
 
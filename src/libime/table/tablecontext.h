@@ -22,6 +22,7 @@
 #include <boost/iterator/iterator_categories.hpp>
 #include <boost/range/any_range.hpp>
 #include <fcitx-utils/macros.h>
+#include <libime/core/decoder.h>
 #include <libime/core/inputbuffer.h>
 #include <libime/table/libimetable_export.h>
 #include <libime/table/tablebaseddictionary.h>
@@ -103,6 +104,12 @@ public:
     /// \since 1.0.12
     void setAutoSelectIndex(size_t index);
 
+    /// Statistics of the last decode, which is updated whenever the input
+    /// changes.
+    ///
+    /// \since 1.1.16
+    const DecodeStats &decodeStats() const;
+
 protected:
     bool typeImpl(const char *s, size_t length) override;
 
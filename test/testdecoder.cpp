@@ -3,16 +3,27 @@
  *
  * SPDX-License-Identifier: LGPL-2.1-or-later
  */
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cstddef>
+#include <functional>
 #include <iostream>
 #include <limits>
 #include <memory>
 #include <ostream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_set>
+#include <vector>
 #include <fcitx-utils/log.h>
 #include "libime/core/decoder.h"
+#include "libime/core/historybigram.h"
 #include "libime/core/languagemodel.h"
 #include "libime/core/lattice.h"
 #include "libime/core/segmentgraph.h"
+#include "libime/core/userlanguagemodel.h"
 #include "libime/pinyin/pinyindecoder.h"
 #include "libime/pinyin/pinyindictionary.h"
 #include "libime/pinyin/pinyinencoder.h"
@@ -42,6 +53,277 @@ void testTime(PinyinDictionary & /*unused*/, Decoder &decoder,
     }
 }
 
+void testCache(Decoder &decoder, std::string_view pinyin) {
+    // Decode every prefix, like the input is typed, with a shared cache.
+    LanguageModelCache cache;
+    for (size_t i = 1; i <= pinyin.size(); i++) {
+        auto graph = PinyinEncoder::parseUserPinyin(
+            std::string(pinyin.substr(0, i)), PinyinFuzzyFlag::Inner);
+        Lattice lattice;
+        Lattice cachedLattice;
+        decoder.decode(lattice, graph, 2, decoder.model()->nullState());
+        DecodeOptions options;
+        options.cache = &cache;
+        decoder.decode(cachedLattice, graph, 2, decoder.model()->nullState(),
+                       std::numeric_limits<float>::max(),
+                       -std::numeric_limits<float>::max(),
+                       Decoder::beamSizeDefault, Decoder::frameSizeDefault,
+                       nullptr, options);
+        FCITX_ASSERT(lattice.sentenceSize() == cachedLattice.sentenceSize());
+        for (size_t j = 0, e = lattice.sentenceSize(); j < e; j++) {
+            FCITX_ASSERT(lattice.sentence(j).toString() ==
+                         cachedLattice.sentence(j).toString());
+            FCITX_ASSERT(lattice.sentence(j).score() ==
+                         cachedLattice.sentence(j).score());
+        }
+    }
+}
+
+void testBudget(Decoder &decoder, std::string_view pinyin) {
+    auto graph = PinyinEncoder::parseUserPinyin(std::string(pinyin),
+                                                PinyinFuzzyFlag::None);
+    Lattice lattice;
+    DecodeOptions options;
+    options.budget.maxModelCalls = 100;
+    FCITX_ASSERT(decoder.decode(lattice, graph, 3, decoder.model()->nullState(),
+                                std::numeric_limits<float>::max(),
+                                -std::numeric_limits<float>::max(),
+                                Decoder::beamSizeDefault,
+                                Decoder::frameSizeDefault, nullptr, options));
+    FCITX_ASSERT(lattice.isDegraded());
+    FCITX_ASSERT(lattice.sentenceSize() >= 1);
+    FCITX_ASSERT(!lattice.sentence(0).toString().empty());
+
+    // Decode again without budget, the result should be the same as a fresh
+    // lattice.
+    Lattice expected;
+    decoder.decode(expected, graph, 3, decoder.model()->nullState());
+    decoder.decode(lattice, graph, 3, decoder.model()->nullState());
+    FCITX_ASSERT(!lattice.isDegraded());
+    FCITX_ASSERT(!expected.isDegraded());
+    FCITX_ASSERT(lattice.sentenceSize() == expected.sentenceSize());
+    for (size_t i = 0, e = lattice.sentenceSize(); i < e; i++) {
+        FCITX_ASSERT(lattice.sentence(i).toString() ==
+                     expected.sentence(i).toString());
+    }
+
+    // A deadline in the past.
+    options.budget = DecodeBudget();
+    options.budget.deadline = std::chrono::steady_clock::now();
+    lattice.clear();
+    decoder.decode(lattice, graph, 3, decoder.model()->nullState(),
+                   std::numeric_limits<float>::max(),
+                   -std::numeric_limits<float>::max(), Decoder::beamSizeDefault,
+                   Decoder::frameSizeDefault, nullptr, options);
+    FCITX_ASSERT(lattice.isDegraded());
+    FCITX_ASSERT(lattice.sentenceSize() == 1);
+}
+
+void testStats(Decoder &decoder, std::string_view pinyin) {
+    auto graph = PinyinEncoder::parseUserPinyin(std::string(pinyin),
+                                                PinyinFuzzyFlag::None);
+    LanguageModelCache cache;
+    DecodeStats stats;
+    DecodeOptions options;
+    options.cache = &cache;
+    options.stats = &stats;
+    for (int i = 0; i < 2; i++) {
+        Lattice lattice;
+        FCITX_ASSERT(decoder.decode(
+            lattice, graph, 3, decoder.model()->nullState(),
+            std::numeric_limits<float>::max(),
+            -std::numeric_limits<float>::max(), Decoder::beamSizeDefault,
+            Decoder::frameSizeDefault, nullptr, options));
+        FCITX_ASSERT(stats.dictionaryMatches >= stats.latticeNodes);
+        FCITX_ASSERT(stats.latticeNodes > 0);
+        FCITX_ASSERT(stats.modelCalls > 0);
+        FCITX_ASSERT(stats.backwardSearchPoolSize > 0);
+        FCITX_ASSERT(!stats.degraded);
+    }
+    // Same input, the second decode should find scores in the cache.
+    FCITX_ASSERT(stats.cacheHits > 0);
+}
+
+void testDedup(Decoder &decoder, std::string_view pinyin) {
+    auto graph = PinyinEncoder::parseUserPinyin(std::string(pinyin),
+                                                PinyinFuzzyFlag::Inner);
+    Lattice lattice;
+    decoder.decode(lattice, graph, 20, decoder.model()->nullState());
+    FCITX_ASSERT(lattice.sentenceSize() > 1);
+    std::unordered_set<std::string> texts;
+    for (size_t i = 0, e = lattice.sentenceSize(); i < e; i++) {
+        const auto &sentence = lattice.sentence(i);
+        FCITX_ASSERT(texts.insert(sentence.toString()).second);
+        for (size_t j = 0; j < i; j++) {
+            FCITX_ASSERT(!sentence.textEquals(lattice.sentence(j)));
+        }
+    }
+}
+
+void testNextSentences(Decoder &decoder, std::string_view pinyin) {
+    auto graph = PinyinEncoder::parseUserPinyin(std::string(pinyin),
+                                                PinyinFuzzyFlag::Inner);
+    Lattice expected;
+    decoder.decode(expected, graph, 3, decoder.model()->nullState());
+    // Continue the same search for more sentences.
+    Lattice lattice;
+    decoder.decode(lattice, graph, 3, decoder.model()->nullState());
+    size_t found = 0;
+    while (size_t count = decoder.nextSentences(lattice, 3)) {
+        found += count;
+    }
+    FCITX_ASSERT(found > 0);
+    FCITX_ASSERT(lattice.sentenceSize() == expected.sentenceSize() + found);
+    std::unordered_set<std::string> texts;
+    for (size_t i = 0, e = lattice.sentenceSize(); i < e; i++) {
+        FCITX_ASSERT(texts.insert(lattice.sentence(i).toString()).second);
+        if (i < expected.sentenceSize()) {
+            FCITX_ASSERT(lattice.sentence(i).toString() ==
+                         expected.sentence(i).toString());
+        }
+    }
+    lattice.clear();
+    FCITX_ASSERT(decoder.nextSentences(lattice, 3) == 0);
+}
+
+void testPartialSort(Decoder &decoder, std::string_view pinyin) {
+    auto graph = PinyinEncoder::parseUserPinyin(std::string(pinyin),
+                                                PinyinFuzzyFlag::Inner);
+    Lattice expected;
+    decoder.decode(expected, graph, 5, decoder.model()->nullState());
+    decoder.setPartialSort(true);
+    Lattice lattice;
+    decoder.decode(lattice, graph, 5, decoder.model()->nullState());
+    decoder.setPartialSort(false);
+    FCITX_ASSERT(lattice.sentence(0).toString() ==
+                 expected.sentence(0).toString());
+    FCITX_ASSERT(lattice.sentence(0).score() == expected.sentence(0).score());
+    for (size_t i = 1; i <= graph.size(); i++) {
+        for (const auto &graphNode : graph.nodes(i)) {
+            std::vector<float> scores;
+            for (const auto &node : lattice.nodes(&graphNode)) {
+                scores.push_back(node.score());
+            }
+            const auto sorted = lattice.sortedSize(&graphNode);
+            FCITX_ASSERT(sorted <= scores.size());
+            FCITX_ASSERT(sorted >= std::min(Decoder::beamSizeDefault,
+                                            scores.size()));
+            FCITX_ASSERT(std::is_sorted(scores.begin(),
+                                        scores.begin() + sorted,
+                                        std::greater<>()));
+            // The rest are not better than the sorted ones.
+            for (size_t j = sorted; j < scores.size(); j++) {
+                FCITX_ASSERT(scores[j] <= scores[sorted - 1]);
+            }
+        }
+    }
+}
+
+void testParallel(Decoder &decoder, std::string_view pinyin) {
+    auto graph = PinyinEncoder::parseUserPinyin(std::string(pinyin),
+                                                PinyinFuzzyFlag::Inner);
+    Lattice expected;
+    decoder.decode(expected, graph, 5, decoder.model()->nullState());
+    decoder.setParallelFor(
+        [](size_t count, const std::function<void(size_t)> &task) {
+            std::atomic<size_t> next = 0;
+            std::vector<std::thread> threads;
+            for (size_t i = 0; i < std::min<size_t>(count, 4); i++) {
+                threads.emplace_back([&next, &task, count]() {
+                    for (size_t j; (j = next++) < count;) {
+                        task(j);
+                    }
+                });
+            }
+            for (auto &thread : threads) {
+                thread.join();
+            }
+        });
+    Lattice lattice;
+    decoder.decode(lattice, graph, 5, decoder.model()->nullState());
+    decoder.setParallelFor({});
+    FCITX_ASSERT(lattice.sentenceSize() == expected.sentenceSize());
+    for (size_t i = 0; i < lattice.sentenceSize(); i++) {
+        FCITX_ASSERT(lattice.sentence(i).toString() ==
+                     expected.sentence(i).toString());
+        FCITX_ASSERT(lattice.sentence(i).score() ==
+                     expected.sentence(i).score());
+    }
+}
+
+void testConcurrent(Decoder &decoder, std::string_view pinyin) {
+    auto graph = PinyinEncoder::parseUserPinyin(std::string(pinyin),
+                                                PinyinFuzzyFlag::Inner);
+    Lattice expected;
+    decoder.decode(expected, graph, 5, decoder.model()->nullState());
+    std::atomic<size_t> mismatch = 0;
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < 4; i++) {
+        threads.emplace_back([&decoder, &graph, &expected, &mismatch]() {
+            LanguageModelCache cache;
+            DecodeOptions options;
+            options.cache = &cache;
+            Lattice lattice;
+            decoder.decode(lattice, graph, 5, decoder.model()->nullState(),
+                           std::numeric_limits<float>::max(),
+                           -std::numeric_limits<float>::max(),
+                           Decoder::beamSizeDefault, Decoder::frameSizeDefault,
+                           nullptr, options);
+            for (size_t j = 0; j < expected.sentenceSize(); j++) {
+                if (lattice.sentence(j).toString() !=
+                    expected.sentence(j).toString()) {
+                    mismatch++;
+                }
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    FCITX_ASSERT(mismatch == 0);
+}
+
+void testUnigramScore(const LanguageModel &model) {
+    FCITX_ASSERT(!model.unigramScores().empty());
+    UserLanguageModel userModel(model.languageModelFile());
+    userModel.history().add({"倪辉", "你好"});
+    for (const LanguageModelBase *m :
+         {static_cast<const LanguageModelBase *>(&model),
+          static_cast<const LanguageModelBase *>(&userModel)}) {
+        for (std::string_view word : {"你好", "倪辉", "", "<unk>"}) {
+            WordNode node(word, m->index(word));
+            State out;
+            FCITX_ASSERT(m->unigramScore(node) ==
+                         m->score(m->nullState(), node, out));
+        }
+    }
+    LanguageModel empty;
+    FCITX_ASSERT(empty.unigramScores().empty());
+    WordNode node("你好", empty.index("你好"));
+    FCITX_ASSERT(empty.unigramScore(node) == empty.unknownPenalty());
+}
+
+void testTextHash() {
+    SegmentGraph graph("ab");
+    graph.addNext(0, 2);
+    SegmentGraphPath path{&graph.start(), &graph.end()};
+    LatticeNode zhongguo("中国", 0, path, State());
+    LatticeNode ren("人", 0, path, State());
+    LatticeNode zhongguoren("中国人", 0, path, State());
+    LatticeNode zhong("中", 0, path, State());
+    LatticeNode guoren("国人", 0, path, State());
+    SentenceResult sentence({&zhongguo, &ren});
+    // Word boundaries do not matter.
+    for (const auto &other : {SentenceResult({&zhongguoren}),
+                              SentenceResult({&zhong, &guoren})}) {
+        FCITX_ASSERT(sentence.textHash() == other.textHash());
+        FCITX_ASSERT(sentence.textEquals(other));
+    }
+    FCITX_ASSERT(!sentence.textEquals(SentenceResult({&zhongguo})));
+    FCITX_ASSERT(!sentence.textEquals(SentenceResult({&ren, &zhongguo})));
+    FCITX_ASSERT(SentenceResult().textEquals(SentenceResult()));
+}
+
 int main() {
     PinyinDictionary dict;
     dict.load(PinyinDictionary::SystemDict, LIBIME_BINARY_DIR "/data/sc.dict",
@@ -101,5 +383,15 @@ int main() {
     testTime(dict, decoder, "sdfsdfsdfsdfsdfsdfsdf", PinyinFuzzyFlag::None, 2);
     testTime(dict, decoder, "ceshiyixiayebuhuichucuo", PinyinFuzzyFlag::None,
              2);
+    testCache(decoder, "zhizuoxujibianchengleshunshuituizhoudeshiqing");
+    testBudget(decoder, "zhizuoxujibianchengleshunshuituizhoudeshiqing");
+    testStats(decoder, "zhizuoxujibianchengleshunshuituizhoudeshiqing");
+    testDedup(decoder, "xianshi");
+    testTextHash();
+    testUnigramScore(model);
+    testNextSentences(decoder, "xianshi");
+    testPartialSort(decoder, "zhizuoxujibianchengleshunshuituizhoudeshiqing");
+    testParallel(decoder, "zhizuoxujibianchengleshunshuituizhoudeshiqing");
+    testConcurrent(decoder, "zhizuoxujibianchengleshunshuituizhoudeshiqing");
     return 0;
 }
@@ -11,6 +11,7 @@
 #include <sstream>
 #include <string>
 #include <unordered_set>
+#include <vector>
 #include <fcitx-utils/log.h>
 #include <fcitx-utils/stringutils.h>
 #include "libime/core/historybigram.h"
@@ -326,6 +327,43 @@ void testAppend() {
         << lines[1];
 }
 
+void testScoreBatch() {
+    using namespace libime;
+    HistoryBigram history;
+    history.addWithCode({{"你", "code1"},
+                         {"是", "code2"},
+                         {"一个", "code3"},
+                         {"好人", "code4"}});
+    history.addWithCode({{"他", "code5"}, {"是", "code2"}});
+
+    std::vector<WordNode> words;
+    for (const auto *word : {"你", "他", "一个", "不是", ""}) {
+        words.emplace_back(word, InvalidWordIndex);
+    }
+    std::vector<const WordNode *> prevs{nullptr};
+    for (const auto &word : words) {
+        prevs.push_back(&word);
+    }
+    ValidationCodeExtractor extractor = [](const WordNode *node) {
+        return node->word() == "他" ? "code5" : "code1";
+    };
+    std::vector<float> scores(prevs.size());
+    for (bool useOnlyUnigram : {false, true}) {
+        history.setUseOnlyUnigram(useOnlyUnigram);
+        for (const auto &cur : words) {
+            history.scoreWithCodeBatch(prevs, &cur, nullptr, scores);
+            for (size_t i = 0; i < prevs.size(); i++) {
+                FCITX_ASSERT(scores[i] == history.score(prevs[i], &cur));
+            }
+            history.scoreWithCodeBatch(prevs, &cur, extractor, scores);
+            for (size_t i = 0; i < prevs.size(); i++) {
+                FCITX_ASSERT(scores[i] ==
+                             history.scoreWithCode(prevs[i], &cur, extractor));
+            }
+        }
+    }
+}
+
 } // namespace
 
 int main() {
@@ -339,5 +377,6 @@ int main() {
     testWithEmptyAndNonEmptyCode();
     testWithCodePredict();
     testAppend();
+    testScoreBatch();
     return 0;
 }
@@ -4,6 +4,7 @@
  * SPDX-License-Identifier: LGPL-2.1-or-later
  */
 
+#include <algorithm>
 #include <array>
 #include <cstddef>
 #include <iostream>
@@ -360,5 +361,82 @@ int main() {
         FCITX_ASSERT(ime.model()->history().containsBigram("他", "爱"));
     }
 
+    {
+        c.clear();
+        c.type("zhizuoxujibianchengleshunshuituizhoudeshiqing");
+        std::vector<std::string> before;
+        for (const auto &candidate : c.candidates()) {
+            before.push_back(candidate.toString());
+        }
+        const auto added = c.loadMoreSentences(3);
+        FCITX_ASSERT(added > 0 && added <= 3) << added;
+        FCITX_ASSERT(c.candidates().size() == before.size() + added);
+        // Existing candidates keep their position, and the sentences are
+        // appended.
+        for (size_t i = 0; i < before.size(); i++) {
+            FCITX_ASSERT(c.candidates()[i].toString() == before[i]);
+        }
+        FCITX_ASSERT(c.candidates()[before.size()].size() > 1);
+        checkCandidateSet(c);
+        checkCandidatesToCursorSet(c);
+        c.clear();
+    }
+
+    {
+        const auto nbest = ime.nbest();
+        const auto wordCandidateLimit = ime.wordCandidateLimit();
+        ime.setWordCandidateLimit(0);
+        ime.setNBest(5);
+        const char *input = "zhizuoxujibianchengleshunshuituizhoudeshiqing";
+        auto candidateStrings = [&c]() {
+            std::vector<std::string> result;
+            for (const auto &candidate : c.candidates()) {
+                result.push_back(candidate.toString());
+            }
+            return result;
+        };
+        c.type(input);
+        const auto all = candidateStrings();
+        const auto fullPoolSize = c.decodeStats().backwardSearchPoolSize;
+
+        c.setCandidatePageSize(5);
+        c.clear();
+        c.type(input);
+        const auto firstPage = candidateStrings();
+        const auto poolSize = c.decodeStats().backwardSearchPoolSize;
+        FCITX_ASSERT(firstPage.size() == 5) << firstPage.size();
+        FCITX_ASSERT(std::equal(firstPage.begin(), firstPage.end(),
+                                all.begin()));
+        checkCandidateSet(c);
+        // Loading all the pages gives the same candidates.
+        while (c.hasMoreCandidates()) {
+            c.loadMoreCandidates(5);
+        }
+        FCITX_ASSERT(c.loadMoreCandidates(5) == 0);
+        auto loaded = candidateStrings();
+        auto expected = all;
+        std::ranges::sort(loaded);
+        std::ranges::sort(expected);
+        FCITX_ASSERT(loaded == expected);
+        checkCandidateSet(c);
+        checkCandidatesToCursorSet(c);
+
+        // The first page doesn't search more sentences with larger nbest.
+        ime.setNBest(50);
+        c.type(input);
+        FCITX_ASSERT(candidateStrings() == firstPage);
+        FCITX_ASSERT(c.decodeStats().backwardSearchPoolSize == poolSize);
+        FCITX_ASSERT(c.hasMoreCandidates());
+
+        c.setCandidatePageSize(0);
+        c.clear();
+        c.type(input);
+        FCITX_ASSERT(c.decodeStats().backwardSearchPoolSize > fullPoolSize);
+
+        ime.setNBest(nbest);
+        ime.setWordCandidateLimit(wordCandidateLimit);
+        c.clear();
+    }
+
     return 0;
 }
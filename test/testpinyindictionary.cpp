@@ -5,11 +5,20 @@
  */
 
 #include <cstddef>
+#include <exception>
+#include <fstream>
+#include <ios>
 #include <iostream>
+#include <memory>
 #include <ostream>
 #include <sstream>
 #include <string_view>
+#include <vector>
+#include <fcitx-utils/connectableobject.h>
 #include <fcitx-utils/log.h>
+#include "libime/core/languagemodel.h"
+#include "libime/core/lattice.h"
+#include "libime/core/segmentgraph.h"
 #include "libime/pinyin/pinyindictionary.h"
 #include "libime/pinyin/pinyinencoder.h"
 #include "testdir.h"
@@ -130,11 +139,129 @@ X光 X'guang
     FCITX_ASSERT(dump.str() == "X光 X'guang 0\n") << "dump: " << dump.str();
 }
 
+void testAsync() {
+    auto future = PinyinDictionary::loadAsync(
+        LIBIME_BINARY_DIR "/test/testpinyindictionary.dict",
+        PinyinDictFormat::Binary);
+    PinyinDictionary dict;
+    PinyinDictionary expected;
+    expected.load(PinyinDictionary::SystemDict,
+                  LIBIME_BINARY_DIR "/test/testpinyindictionary.dict",
+                  PinyinDictFormat::Binary);
+    dict.setTrie(PinyinDictionary::SystemDict, future.get());
+    FCITX_ASSERT(dict.trie(PinyinDictionary::SystemDict)->size() > 0);
+    FCITX_ASSERT(dict.trie(PinyinDictionary::SystemDict)->size() ==
+                 expected.trie(PinyinDictionary::SystemDict)->size());
+
+    bool thrown = false;
+    try {
+        PinyinDictionary::loadAsync(LIBIME_BINARY_DIR "/test/nonexistent",
+                                    PinyinDictFormat::Binary)
+            .get();
+    } catch (const std::exception &) {
+        thrown = true;
+    }
+    FCITX_ASSERT(thrown);
+}
+
+void testImage() {
+    PinyinDictionary dict;
+    dict.load(PinyinDictionary::SystemDict,
+              LIBIME_BINARY_DIR "/test/testpinyindictionary.dict",
+              PinyinDictFormat::Binary);
+    dict.save(PinyinDictionary::SystemDict,
+              LIBIME_BINARY_DIR "/test/testpinyindictionary.img.dict",
+              PinyinDictFormat::Image);
+    const auto *expected = dict.trie(PinyinDictionary::SystemDict);
+
+    // Image is mapped when loaded from file, and read from stream.
+    PinyinDictionary image;
+    image.load(PinyinDictionary::SystemDict,
+               LIBIME_BINARY_DIR "/test/testpinyindictionary.img.dict",
+               PinyinDictFormat::Binary);
+    std::ifstream in(LIBIME_BINARY_DIR "/test/testpinyindictionary.img.dict",
+                     std::ios::in | std::ios::binary);
+    image.load(PinyinDictionary::UserDict, in, PinyinDictFormat::Image);
+    FCITX_ASSERT(image.trie(PinyinDictionary::SystemDict)->isMapped());
+    FCITX_ASSERT(!image.trie(PinyinDictionary::UserDict)->isMapped());
+    for (size_t idx :
+         {PinyinDictionary::SystemDict, PinyinDictionary::UserDict}) {
+        FCITX_ASSERT(image.trie(idx)->size() == expected->size());
+        FCITX_ASSERT(image.lookupWord(idx, "ni'hao", "你好"));
+    }
+}
+
+void testWordIndex() {
+    PinyinDictionary dict;
+    dict.load(PinyinDictionary::SystemDict,
+              LIBIME_BINARY_DIR "/data/dict_sc.txt", PinyinDictFormat::Text);
+    auto file = std::make_shared<StaticLanguageModelFile>(LIBIME_BINARY_DIR
+                                                          "/data/sc.lm");
+    auto model = std::make_unique<LanguageModel>(file);
+    dict.setLanguageModelFile(file);
+    // Changed sub dictionary is indexed again.
+    dict.addWord(PinyinDictionary::UserDict, testPinyin1, testHanzi1);
+
+    auto graph = PinyinEncoder::parseUserPinyin("nihuixiaoqie",
+                                                PinyinFuzzyFlag::None);
+    auto check = [&]() {
+        size_t resolved = 0;
+        bool foundUserWord = false;
+        dict.matchPrefix(graph, [&](const SegmentGraphPath &, WordNode &word,
+                                    float, std::unique_ptr<LatticeNodeData>) {
+            if (word.idx() != InvalidWordIndex) {
+                FCITX_ASSERT(word.idx() == model->index(word.word()))
+                    << word.word();
+                resolved++;
+            }
+            foundUserWord = foundUserWord || word.word() == testHanzi1;
+        });
+        FCITX_ASSERT(resolved > 0);
+        return foundUserWord;
+    };
+    FCITX_ASSERT(check());
+    // Cached indexes are dropped when nodes of the trie move.
+    dict.addWord(PinyinDictionary::UserDict, "ni'hui", "你会");
+    dict.addWord(PinyinDictionary::UserDict, "ni'hui'xiao", "你会笑");
+    FCITX_ASSERT(check());
+    dict.removeWord(PinyinDictionary::UserDict, testPinyin1, testHanzi1);
+    FCITX_ASSERT(!check());
+
+    // Switching the file after a match tells the users of the dictionary to
+    // drop what they matched.
+    std::vector<size_t> changed;
+    fcitx::ScopedConnection conn =
+        dict.connect<PinyinDictionary::dictionaryChanged>(
+            [&changed](size_t idx) { changed.push_back(idx); });
+    dict.setLanguageModelFile(file);
+    FCITX_ASSERT(changed.empty());
+    file = std::make_shared<StaticLanguageModelFile>(LIBIME_BINARY_DIR
+                                                     "/data/sc.lm");
+    model = std::make_unique<LanguageModel>(file);
+    dict.setLanguageModelFile(file);
+    FCITX_ASSERT(changed.size() == dict.dictSize());
+    for (size_t i = 0; i < changed.size(); i++) {
+        FCITX_ASSERT(changed[i] == i);
+    }
+    FCITX_ASSERT(!check());
+
+    changed.clear();
+    dict.setLanguageModelFile(nullptr);
+    FCITX_ASSERT(changed.size() == dict.dictSize());
+    dict.matchPrefix(graph, [](const SegmentGraphPath &, WordNode &word,
+                               float, std::unique_ptr<LatticeNodeData>) {
+        FCITX_ASSERT(word.idx() == InvalidWordIndex || word.word().empty());
+    });
+}
+
 } // namespace
 
 int main() {
     testBasic();
     testEscape();
     testLetter();
+    testAsync();
+    testImage();
+    testWordIndex();
     return 0;
 }
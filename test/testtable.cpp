@@ -93,6 +93,14 @@ void testWubi() {
         table.statistic();
         // table.save(std::cout, libime::TableFormat::Text);
 
+        // The tries of image are mapped instead of being read.
+        table.save(LIBIME_BINARY_DIR "/test/testtable.img.dict",
+                   TableFormat::Image);
+        table.load(LIBIME_BINARY_DIR "/test/testtable.img.dict");
+        FCITX_ASSERT(table.hasRule());
+        FCITX_ASSERT(table.hasPinyin());
+        table.statistic();
+
         std::string key2;
         FCITX_ASSERT(table.generate("统计局", key2));
         FCITX_ASSERT(key == key2);
@@ -7,6 +7,7 @@
 #include <algorithm>
 #include <cstddef>
 #include <iterator>
+#include <memory>
 #include <string>
 #include <string_view>
 #include <fcitx-utils/log.h>
@@ -168,10 +169,56 @@ void testHistory() {
     FCITX_ASSERT(index3 < index2);
 }
 
+void testLoadOptions() {
+    TestLmResolver lmresolver(LIBIME_BINARY_DIR "/data/sc.lm");
+    LanguageModel expected(lmresolver.languageModelFileForLanguage("zh_CN"));
+    for (auto method :
+         {LanguageModelLoadMethod::Lazy, LanguageModelLoadMethod::Read,
+          LanguageModelLoadMethod::ParallelRead}) {
+        TestLmResolver resolver(LIBIME_BINARY_DIR "/data/sc.lm");
+        LanguageModelLoadOptions options;
+        options.method = method;
+        options.willNeed = true;
+        resolver.setLoadOptions(options);
+        auto file = resolver.languageModelFileForLanguage("zh_CN");
+        FCITX_ASSERT(file->loadOptions().method == method);
+        FCITX_ASSERT(file->fileSize() > 0);
+        FCITX_ASSERT(file->residentSize() <= file->fileSize());
+        if (method != LanguageModelLoadMethod::Lazy) {
+            FCITX_ASSERT(file->residentSize() == file->fileSize());
+        }
+        LanguageModel model(file);
+        FCITX_ASSERT(model.singleWordScore("其") ==
+                     expected.singleWordScore("其"));
+    }
+}
+
+void testAsync() {
+    TestLmResolver lmresolver(LIBIME_BINARY_DIR "/data/sc.lm");
+    auto future = lmresolver.languageModelFileForLanguageAsync("zh_CN");
+    auto dictFuture = TableBasedDictionary::loadAsync(LIBIME_BINARY_DIR
+                                                      "/data/wbx.main.dict");
+    // Waits for the load in background instead of loading again.
+    auto lm = lmresolver.languageModelFileForLanguage("zh_CN");
+    FCITX_ASSERT(future.get() == lm);
+    FCITX_ASSERT(!lmresolver.languageModelFileForLanguageAsync("en").get());
+    auto dict = dictFuture.get();
+    FCITX_ASSERT(dict->hasMatchingWords("a"));
+
+    TestLmResolver preloadResolver(LIBIME_BINARY_DIR "/data/sc.lm");
+    preloadResolver.preloadLanguages({"zh_CN"});
+    std::weak_ptr<const StaticLanguageModelFile> preloaded =
+        preloadResolver.languageModelFileForLanguage("zh_CN");
+    // Still kept by the resolver.
+    FCITX_ASSERT(!preloaded.expired());
+}
+
 } // namespace
 
 int main() {
     testBasic();
     testHistory();
+    testLoadOptions();
+    testAsync();
     return 0;
 }
@@ -3,10 +3,20 @@
  *
  * SPDX-License-Identifier: LGPL-2.1-or-later
  */
+#include <algorithm>
+#include <cmath>
 #include <cstdint>
 #include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
 #include <fcitx-utils/log.h>
 #include "libime/core/datrie.h"
+#include "testdir.h"
 
 using namespace libime;
 
@@ -70,5 +80,404 @@ int main() {
         trie.erase(pos);
         FCITX_ASSERT(trie.size() == 4);
     }
+
+    {
+        DATrie<float> trie;
+        trie.set("aaaa", 1);
+        trie.set("aaab", 2);
+        trie.set("aab", 3);
+        trie.set("b", 4);
+
+        std::stringstream ss;
+        trie.saveImage(ss);
+        DATrie<float> copied;
+        copied.loadImage(ss);
+        FCITX_ASSERT(!copied.isMapped());
+        FCITX_ASSERT(copied.size() == 4);
+        FCITX_ASSERT(copied.exactMatchSearch("aaab") == 2);
+
+        const char *file = LIBIME_BINARY_DIR "/test/testtrie.image";
+        trie.saveImage(file);
+        DATrie<float> mapped;
+        mapped.loadImage(file);
+        FCITX_ASSERT(mapped.isMapped());
+        FCITX_ASSERT(mapped.size() == 4);
+        FCITX_ASSERT(mapped.exactMatchSearch("aab") == 3);
+        FCITX_ASSERT(mapped.isNoValue(mapped.exactMatchSearch("aa")));
+        std::string key;
+        size_t count = 0;
+        mapped.foreach("aa", [&](float value, size_t len, uint64_t pos) {
+            mapped.suffix(key, len + 2, pos);
+            FCITX_ASSERT(trie.exactMatchSearch(key) == value);
+            count++;
+            return true;
+        });
+        FCITX_ASSERT(count == 3);
+
+        // Copy is independent from the mapping.
+        DATrie<float> copy = mapped;
+        FCITX_ASSERT(!copy.isMapped());
+
+        // Modification detaches the trie from the image.
+        mapped.set("c", 5);
+        FCITX_ASSERT(!mapped.isMapped());
+        FCITX_ASSERT(mapped.size() == 5);
+        FCITX_ASSERT(mapped.exactMatchSearch("aaaa") == 1);
+        FCITX_ASSERT(copy.size() == 4);
+
+        // Images saved one after another after a header, like dictionaries.
+        DATrie<float> quantized = trie;
+        quantized.quantize(8);
+        {
+            std::ofstream fout(file, std::ios::out | std::ios::binary);
+            fout.write("header..", 8);
+            trie.saveImage(fout);
+            quantized.saveImage(fout);
+            trie.saveImage(fout);
+        }
+        DATrie<float> first;
+        DATrie<float> second;
+        DATrie<float> third;
+        auto offset = first.loadImage(file, 8);
+        offset = second.loadImage(file, offset);
+        offset = third.loadImage(file, offset);
+        FCITX_ASSERT(offset == static_cast<size_t>(
+                                   std::ifstream(file, std::ios::ate).tellg()));
+        for (const auto *loaded : {&first, &second, &third}) {
+            FCITX_ASSERT(loaded->isMapped());
+            FCITX_ASSERT(loaded->size() == 4);
+        }
+        FCITX_ASSERT(first.exactMatchSearch("aab") == 3);
+        FCITX_ASSERT(second.isQuantized());
+        FCITX_ASSERT(second.exactMatchSearch("aab") ==
+                     quantized.exactMatchSearch("aab"));
+        FCITX_ASSERT(third.exactMatchSearch("b") == 4);
+
+        std::ifstream fin(file, std::ios::in | std::ios::binary);
+        fin.ignore(8);
+        for (auto *loaded : {&first, &second, &third}) {
+            loaded->loadImage(fin);
+            FCITX_ASSERT(!loaded->isMapped());
+            FCITX_ASSERT(loaded->size() == 4);
+        }
+        FCITX_ASSERT(fin.peek() == std::ifstream::traits_type::eof());
+    }
+
+    {
+        std::vector<std::pair<std::string_view, int32_t>> entries = {
+            {"a", 1}, {"aa", 2}, {"ab", 3}, {"ab", 4}, {"abcd", 5}, {"b", 6}};
+        DATrie<int32_t> trie;
+        trie.set("c", 1);
+        trie.build(entries);
+        FCITX_ASSERT(trie.size() == 5);
+        FCITX_ASSERT(trie.isNoValue(trie.exactMatchSearch("c")));
+        FCITX_ASSERT(trie.exactMatchSearch("a") == 1);
+        FCITX_ASSERT(trie.exactMatchSearch("ab") == 4);
+        FCITX_ASSERT(trie.exactMatchSearch("abcd") == 5);
+        FCITX_ASSERT(trie.isNoValue(trie.exactMatchSearch("abc")));
+        DATrie<int32_t>::position_type pos = 0;
+        FCITX_ASSERT(trie.traverse("ab", pos) == 4);
+        FCITX_ASSERT(trie.traverse("cd", pos) == 5);
+
+        // Built trie can still be modified.
+        trie.set("abce", 7);
+        trie.erase("aa");
+        FCITX_ASSERT(trie.size() == 5);
+        FCITX_ASSERT(trie.exactMatchSearch("abcd") == 5);
+        FCITX_ASSERT(trie.exactMatchSearch("abce") == 7);
+
+        std::vector<std::pair<std::string_view, int32_t>> unsorted = {
+            {"b", 1}, {"a", 2}};
+        bool thrown = false;
+        try {
+            trie.build(unsorted);
+        } catch (const std::invalid_argument &) {
+            thrown = true;
+        }
+        FCITX_ASSERT(thrown);
+    }
+
+    {
+        DATrie<int32_t> trie;
+        trie.set("abc", 1);
+        trie.set("abd", 2);
+        trie.set("ab", 3);
+        trie.set("b", 4);
+        std::vector<std::pair<std::string, int32_t>> keys;
+        trie.foreachKey([&keys](int32_t value, std::string_view key,
+                                DATrie<int32_t>::position_type) {
+            keys.emplace_back(key, value);
+            return true;
+        });
+        FCITX_ASSERT(keys.size() == 4);
+        for (const auto &[key, value] : keys) {
+            FCITX_ASSERT(trie.exactMatchSearch(key) == value);
+        }
+
+        // Key passed to visitor always contains the whole key.
+        keys.clear();
+        trie.foreachKey("ab", [&keys, &trie](int32_t value,
+                                             std::string_view key,
+                                             DATrie<int32_t>::position_type
+                                                 pos) {
+            FCITX_ASSERT(key.starts_with("ab"));
+            std::string suffix;
+            trie.suffix(suffix, key.size(), pos);
+            FCITX_ASSERT(suffix == key);
+            keys.emplace_back(key, value);
+            return true;
+        });
+        FCITX_ASSERT(keys.size() == 3);
+
+        // Start from a position inside the tail.
+        DATrie<int32_t>::position_type pos = 0;
+        trie.traverse("ab", pos);
+        trie.traverse("c", pos);
+        size_t count = 0;
+        trie.foreachKey(
+            [&count](int32_t value, std::string_view key,
+                     DATrie<int32_t>::position_type) {
+                FCITX_ASSERT(key == "abc");
+                FCITX_ASSERT(value == 1);
+                count++;
+                return true;
+            },
+            pos);
+        FCITX_ASSERT(count == 1);
+
+        // Stop early.
+        count = 0;
+        FCITX_ASSERT(!trie.foreachKey(
+            [&count](int32_t, std::string_view,
+                     DATrie<int32_t>::position_type) {
+                count++;
+                return false;
+            }));
+        FCITX_ASSERT(count == 1);
+    }
+
+    {
+        DATrie<float> trie;
+        trie.set("a", -3);
+        trie.set("ab", -1);
+        trie.set("abc", -4);
+        trie.set("abd", -2);
+        trie.set("b", -0.5);
+        auto check = [](const auto &result) {
+            FCITX_ASSERT(result.size() == 3);
+            FCITX_ASSERT(result[0].first == "ab" && result[0].second == -1);
+            FCITX_ASSERT(result[1].first == "abd" && result[1].second == -2);
+            FCITX_ASSERT(result[2].first == "a" && result[2].second == -3);
+        };
+        FCITX_ASSERT(!trie.hasTopKIndex());
+        check(trie.topK("a", 3));
+        trie.buildTopKIndex();
+        FCITX_ASSERT(trie.hasTopKIndex());
+        check(trie.topK("a", 3));
+        FCITX_ASSERT(trie.topK("", 0).size() == 5);
+        FCITX_ASSERT(trie.topK("", 1)[0].first == "b");
+        FCITX_ASSERT(trie.topK("c", 1).empty());
+
+        DATrie<float>::position_type pos = 0;
+        trie.traverse("abc", pos);
+        auto result = trie.topK("", 2, pos);
+        FCITX_ASSERT(result.size() == 1 && result[0].first == "abc");
+
+        trie.set("ac", 0);
+        FCITX_ASSERT(!trie.hasTopKIndex());
+        FCITX_ASSERT(trie.topK("a", 1)[0].first == "ac");
+
+        DATrie<uint32_t> index;
+        index.set("a", 3);
+        index.set("ab", 1);
+        index.set("b", 0);
+        index.buildTopKIndex(DATrie<uint32_t>::TopKOrder::Smallest);
+        auto smallest = index.topK("a", 1);
+        FCITX_ASSERT(smallest.size() == 1 && smallest[0].second == 1);
+    }
+
+    {
+        DATrie<int32_t> trie;
+        trie.set("ab", 1);
+        trie.set("ac", 2);
+        trie.set("a", 3);
+        trie.set("bcd", 4);
+        auto children = [&trie](DATrie<int32_t>::position_type pos) {
+            std::string labels;
+            trie.foreachChild(pos, [&trie, &labels, pos](
+                                       uint8_t label,
+                                       DATrie<int32_t>::position_type next) {
+                auto expect = pos;
+                const char c = static_cast<char>(label);
+                FCITX_ASSERT(
+                    !trie.isNoPathRaw(trie.traverseRaw(&c, 1, expect)));
+                FCITX_ASSERT(expect == next);
+                labels.push_back(c);
+                return true;
+            });
+            return labels;
+        };
+        FCITX_ASSERT(children(0) == "ab");
+        DATrie<int32_t>::position_type pos = 0;
+        trie.traverse("a", pos);
+        FCITX_ASSERT(children(pos) == "bc");
+        trie.traverse("b", pos);
+        FCITX_ASSERT(children(pos).empty());
+        // Walk along the tail.
+        pos = 0;
+        trie.traverse("b", pos);
+        FCITX_ASSERT(children(pos) == "c");
+        trie.traverse("c", pos);
+        FCITX_ASSERT(children(pos) == "d");
+        trie.traverse("d", pos);
+        FCITX_ASSERT(children(pos).empty());
+    }
+
+    {
+        DATrie<int32_t> trie;
+        for (int i = 0; i < 1000; i++) {
+            trie.set("key" + std::to_string(i), i);
+        }
+        for (int i = 0; i < 1000; i += 2) {
+            trie.erase("key" + std::to_string(i));
+        }
+        trie.buildTopKIndex();
+        auto stats = trie.stats();
+        FCITX_ASSERT(stats.keys == 500);
+        FCITX_ASSERT(stats.deadTailBytes > 0);
+        FCITX_ASSERT(stats.deadTailBytes < stats.tailBytes);
+
+        trie.compact();
+        auto compacted = trie.stats();
+        FCITX_ASSERT(compacted.keys == 500);
+        FCITX_ASSERT(compacted.deadTailBytes == 0);
+        FCITX_ASSERT(compacted.nodes <= stats.nodes);
+        FCITX_ASSERT(trie.hasTopKIndex());
+        for (int i = 0; i < 1000; i++) {
+            auto value = trie.exactMatchSearch("key" + std::to_string(i));
+            if (i % 2) {
+                FCITX_ASSERT(value == i);
+            } else {
+                FCITX_ASSERT(trie.isNoValue(value));
+            }
+        }
+        trie.set("key0", 0);
+        FCITX_ASSERT(trie.size() == 501);
+    }
+    {
+        DATrie<int32_t> trie;
+        const char *words[] = {"phrase", "longer phrase", "another phrase"};
+        const char *codes[] = {"a", "ab", "abc", "b", "zz"};
+        int32_t value = 0;
+        for (const auto *code : codes) {
+            for (const auto *word : words) {
+                trie.set(std::string(code) + '\x01' + word, value++);
+            }
+        }
+        auto tailBytes = trie.stats().tailBytes;
+        trie.shareTail();
+        FCITX_ASSERT(trie.isTailShared());
+        FCITX_ASSERT(trie.stats().tailBytes < tailBytes);
+        value = 0;
+        for (const auto *code : codes) {
+            for (const auto *word : words) {
+                auto key = std::string(code) + '\x01' + word;
+                FCITX_ASSERT(trie.exactMatchSearch(key) == value++);
+            }
+        }
+        std::string key;
+        trie.foreach([&trie, &key](int32_t value, size_t len,
+                                   DATrie<int32_t>::position_type pos) {
+            trie.suffix(key, len, pos);
+            FCITX_ASSERT(trie.exactMatchSearch(key) == value);
+            return true;
+        });
+
+        const char *image = LIBIME_BINARY_DIR "/test/testtrie.image";
+        trie.saveImage(image);
+        DATrie<int32_t> loaded;
+        loaded.loadImage(image);
+        FCITX_ASSERT(loaded.isTailShared());
+        FCITX_ASSERT(loaded.exactMatchSearch("abc\x01phrase") == 6);
+        loaded.set("c\x01phrase", 100);
+        FCITX_ASSERT(!loaded.isTailShared());
+        FCITX_ASSERT(loaded.exactMatchSearch("abc\x01phrase") == 6);
+        FCITX_ASSERT(loaded.exactMatchSearch("c\x01phrase") == 100);
+        FCITX_ASSERT(loaded.size() == 16);
+    }
+    {
+        DATrie<float> trie;
+        for (int i = 0; i < 1000; i++) {
+            trie.set("key" + std::to_string(i), static_cast<float>(i % 300));
+        }
+        trie.erase("key1");
+        auto tailBytes = trie.stats().tailBytes;
+        trie.quantize(16);
+        FCITX_ASSERT(trie.isQuantized());
+        FCITX_ASSERT(trie.stats().tailBytes < tailBytes);
+        // Less distinct values than the levels, so nothing is lost.
+        for (int i = 2; i < 1000; i++) {
+            FCITX_ASSERT(trie.exactMatchSearch("key" + std::to_string(i)) ==
+                         static_cast<float>(i % 300));
+        }
+        FCITX_ASSERT(trie.isNoValue(trie.exactMatchSearch("key1")));
+
+        trie.quantize(8);
+        float maxError = 0;
+        for (int i = 2; i < 1000; i++) {
+            const auto value = static_cast<float>(i % 300);
+            maxError = std::max(
+                maxError,
+                std::abs(trie.exactMatchSearch("key" + std::to_string(i)) -
+                         value));
+        }
+        FCITX_ASSERT(maxError > 0 && maxError < 2);
+
+        const char *image = LIBIME_BINARY_DIR "/test/testtrie.image";
+        trie.saveImage(image);
+        DATrie<float> loaded;
+        loaded.loadImage(image);
+        FCITX_ASSERT(loaded.isQuantized());
+        auto value = loaded.exactMatchSearch("key299");
+        loaded.set("key1", 1);
+        FCITX_ASSERT(!loaded.isQuantized());
+        FCITX_ASSERT(loaded.exactMatchSearch("key299") == value);
+        FCITX_ASSERT(loaded.exactMatchSearch("key1") == 1);
+        FCITX_ASSERT(loaded.size() == 1000);
+    }
+    {
+        DATrie<int32_t> trie;
+        for (int i = 0; i < 100; i++) {
+            trie.set("key" + std::to_string(i), i);
+        }
+        std::vector<std::string> keys;
+        for (int i = 0; i < 120; i++) {
+            keys.push_back("key" + std::to_string(i));
+        }
+        keys.push_back("key");
+        keys.push_back("");
+        std::vector<std::string_view> views(keys.begin(), keys.end());
+        std::vector<int32_t> results(views.size());
+        trie.exactMatchSearchBatch(views, results);
+        for (size_t i = 0; i < views.size(); i++) {
+            FCITX_ASSERT(results[i] == trie.exactMatchSearch(views[i]));
+        }
+        FCITX_ASSERT(results[99] == 99);
+        FCITX_ASSERT(trie.isNoValue(results[100]));
+
+        std::vector<std::string_view> prefixes(views.size(), "key1");
+        std::vector<DATrie<int32_t>::position_type> positions(views.size());
+        trie.traverseBatch(prefixes, positions, results);
+        FCITX_ASSERT(std::ranges::all_of(
+            results, [](int32_t value) { return value == 1; }));
+        std::vector<std::string_view> suffixes = {"0", "5", "55", ""};
+        positions.resize(suffixes.size());
+        results.resize(suffixes.size());
+        trie.traverseBatch(suffixes, positions, results);
+        FCITX_ASSERT(results[0] == 10);
+        FCITX_ASSERT(results[1] == 15);
+        FCITX_ASSERT(trie.isNoPath(results[2]));
+        FCITX_ASSERT(results[3] == 1);
+    }
     return 0;
 }
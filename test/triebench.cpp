@@ -4,94 +4,350 @@
  * SPDX-License-Identifier: LGPL-2.1-or-later
  */
 #include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <cstddef>
 #include <cstdint>
+#include <cstdlib>
+#include <functional>
 #include <iostream>
+#include <random>
+#include <sstream>
 #include <string>
-#include <unordered_map>
+#include <string_view>
+#include <unordered_set>
+#include <utility>
 #include <vector>
 #include <fcitx-utils/log.h>
 #include "libime/core/datrie.h"
 
 using namespace libime;
 
-int main() {
-    typedef DATrie<int32_t> TestTrie;
-    TestTrie tree;
-    std::string key;
-    std::unordered_map<std::string, int32_t> map;
-
-    int count = 1;
-    // key can be same as other
-    while (std::cin >> key) {
-        map[key] = count;
-        tree.update(key,
-                    [count, &map,
-                     &key](TestTrie::value_type v) -> TestTrie::value_type {
-                        if (v != 0) {
-                            // this is a key inserted twice
-                            FCITX_ASSERT(map.find(key) != map.end());
-                        }
-                        // std::cout << key << " " << v << " " << count <<
-                        // std::endl;
-                        return count;
-                    });
-        FCITX_ASSERT(tree.exactMatchSearch(key) == count);
-        count++;
+namespace {
+
+using TestTrie = DATrie<int32_t>;
+using Clock = std::chrono::steady_clock;
+
+enum class KeyType { Pinyin, Table };
+enum class Distribution { Uniform, Zipf };
+
+struct Options {
+    size_t keys = 200000;
+    size_t queries = 200000;
+    KeyType type = KeyType::Pinyin;
+    Distribution distribution = Distribution::Zipf;
+    double zipfExponent = 1.0;
+    uint32_t seed = 1;
+};
+
+constexpr std::string_view initials[] = {
+    "", "b", "p", "m", "f", "d", "t", "n", "l", "g", "k", "h", "j", "q", "x",
+    "zh", "ch", "sh", "r", "z", "c", "s", "y", "w"};
+constexpr std::string_view finals[] = {
+    "a", "o", "e", "ai", "ei", "ao", "ou", "an", "en", "ang", "eng", "ong", "i",
+    "ia", "ie", "iao", "iu", "ian", "in", "iang", "ing", "iong", "u", "ua",
+    "uo", "uai", "ui", "uan", "un", "uang", "v", "ve"};
+
+// Pick index in [0, n) with the probability of rank^-exponent.
+class ZipfDistribution {
+public:
+    ZipfDistribution(size_t n, double exponent) : cdf_(n) {
+        double sum = 0;
+        for (size_t i = 0; i < n; i++) {
+            sum += 1.0 / std::pow(static_cast<double>(i + 1), exponent);
+            cdf_[i] = sum;
+        }
+        for (auto &value : cdf_) {
+            value /= sum;
+        }
+    }
+
+    template <typename Engine>
+    size_t operator()(Engine &engine) {
+        const double value = std::uniform_real_distribution<>()(engine);
+        auto iter = std::ranges::lower_bound(cdf_, value);
+        return std::min<size_t>(iter - cdf_.begin(), cdf_.size() - 1);
     }
 
-    std::vector<TestTrie::value_type> d;
-    d.resize(tree.size());
-    tree.dump(d.data(), d.size());
+private:
+    std::vector<double> cdf_;
+};
 
-    FCITX_ASSERT(tree.size() == map.size());
-    for (auto &p : map) {
-        // std::cout << p.first << " " << tree.exactMatchSearch(p.first) << " "
-        // << p.second <<
-        // std::endl;
-        FCITX_ASSERT(tree.exactMatchSearch(p.first) == p.second);
+void appendUtf8(std::string &str, uint32_t chr) {
+    // Only BMP is needed for CJK.
+    str.push_back(static_cast<char>(0xe0 | (chr >> 12)));
+    str.push_back(static_cast<char>(0x80 | ((chr >> 6) & 0x3f)));
+    str.push_back(static_cast<char>(0x80 | (chr & 0x3f)));
+}
+
+// Keys are like code, separator, then word, the same as dictionaries. The
+// same word may have several codes, and common characters are picked more.
+std::vector<std::string> generateKeys(const Options &options) {
+    std::mt19937 engine(options.seed);
+    ZipfDistribution character(3500, 1.0);
+    ZipfDistribution initialRank(std::size(initials), 0.5);
+    ZipfDistribution finalRank(std::size(finals), 0.5);
+    std::uniform_int_distribution<size_t> length(1, 4);
+    std::uniform_int_distribution<int> letter('a', 'z');
+    std::unordered_set<std::string> seen;
+    std::vector<std::string> keys;
+    keys.reserve(options.keys);
+    std::string word;
+    while (keys.size() < options.keys) {
+        word.clear();
+        const auto wordLength = length(engine);
+        std::string code;
+        for (size_t i = 0; i < wordLength; i++) {
+            appendUtf8(word, 0x4e00 + character(engine));
+            if (options.type == KeyType::Pinyin) {
+                if (i) {
+                    code.push_back('\'');
+                }
+                code.append(initials[initialRank(engine)]);
+                code.append(finals[finalRank(engine)]);
+            } else if (wordLength == 1) {
+                for (size_t j = length(engine); j > 0; j--) {
+                    code.push_back(static_cast<char>(letter(engine)));
+                }
+            } else {
+                code.push_back(static_cast<char>(letter(engine)));
+            }
+        }
+        auto key = code + '\x01' + word;
+        if (seen.insert(key).second) {
+            keys.push_back(std::move(key));
+        }
     }
+    return keys;
+}
 
-    std::string tempKey;
-    size_t foreach_count = 0;
-    tree.foreach([&tree, &map, &tempKey, &foreach_count](
-                     TestTrie::value_type value, size_t len, uint64_t pos) {
-        (void)value;
-        tree.suffix(tempKey, len, pos);
-        FCITX_ASSERT(map.find(tempKey) != map.end());
-        FCITX_ASSERT(tree.exactMatchSearch(tempKey) == value);
-        FCITX_ASSERT(map[tempKey] == value);
-        tree.update(tempKey, [](int32_t v) { return v + 1; });
-        foreach_count++;
-        return true;
-    });
+struct Result {
+    std::string phase;
+    size_t ops = 0;
+    double seconds = 0;
+    std::vector<int64_t> latencies;
+};
+
+void report(Result &result) {
+    std::cout << "{\"phase\":\"" << result.phase << "\",\"ops\":" << result.ops
+              << ",\"seconds\":" << result.seconds << ",\"ops_per_sec\":"
+              << (result.seconds > 0 ? result.ops / result.seconds : 0);
+    if (!result.latencies.empty()) {
+        auto &latencies = result.latencies;
+        std::ranges::sort(latencies);
+        auto percentile = [&latencies](double p) {
+            return latencies[static_cast<size_t>(
+                p * static_cast<double>(latencies.size() - 1))];
+        };
+        std::cout << ",\"p50_ns\":" << percentile(0.5)
+                  << ",\"p90_ns\":" << percentile(0.9)
+                  << ",\"p99_ns\":" << percentile(0.99)
+                  << ",\"max_ns\":" << latencies.back();
+    }
+    std::cout << "}" << std::endl;
+}
+
+// Time the whole phase, which runs ops operations.
+void runPhase(const std::string &phase, size_t ops,
+              const std::function<void()> &func) {
+    Result result;
+    result.phase = phase;
+    result.ops = ops;
+    auto start = Clock::now();
+    func();
+    result.seconds =
+        std::chrono::duration<double>(Clock::now() - start).count();
+    report(result);
+}
+
+// Time each operation as well, for the latency percentiles.
+void runLatencyPhase(const std::string &phase, size_t ops,
+                     const std::function<void(size_t)> &func) {
+    Result result;
+    result.phase = phase;
+    result.ops = ops;
+    result.latencies.reserve(ops);
+    auto phaseStart = Clock::now();
+    for (size_t i = 0; i < ops; i++) {
+        auto start = Clock::now();
+        func(i);
+        result.latencies.push_back(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() -
+                                                                 start)
+                .count());
+    }
+    result.seconds =
+        std::chrono::duration<double>(Clock::now() - phaseStart).count();
+    report(result);
+}
+
+void reportMemory(const std::string &phase, const TestTrie &trie) {
+    std::cout << "{\"phase\":\"" << phase << "\",\"keys\":" << trie.size()
+              << ",\"mem_size\":" << trie.mem_size() << "}" << std::endl;
+}
 
-    tree.erase(map.begin()->first);
-    FCITX_ASSERT(tree.size() == foreach_count - 1);
-
-    tree.save("trie_data");
-
-    tree.clear();
-
-    FCITX_ASSERT(!tree.erase(map.begin()->first));
-    FCITX_ASSERT(tree.empty());
-    decltype(tree) trie2("trie_data");
-    using std::swap;
-    swap(tree, trie2);
-
-    foreach_count = 0;
-    tree.foreach([&tree, &map, &tempKey,
-                  &foreach_count](int32_t value, size_t len, uint64_t pos) {
-        (void)value;
-        tree.suffix(tempKey, len, pos);
-        FCITX_ASSERT(map.find(tempKey) != map.end());
-        FCITX_ASSERT(tree.exactMatchSearch(tempKey) == value);
-        FCITX_ASSERT(map[tempKey] + 1 == value);
-        foreach_count++;
-        return true;
+void usage(const char *argv0) {
+    std::cerr << "Usage: " << argv0
+              << " [-n keys] [-q queries] [-t pinyin|table] [-d zipf|uniform]"
+                 " [-z exponent] [-s seed]"
+              << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    Options options;
+    int c;
+    while ((c = getopt(argc, argv, "n:q:t:d:z:s:h")) != -1) {
+        switch (c) {
+        case 'n':
+            options.keys = std::strtoul(optarg, nullptr, 10);
+            break;
+        case 'q':
+            options.queries = std::strtoul(optarg, nullptr, 10);
+            break;
+        case 't':
+            if (std::string_view(optarg) == "pinyin") {
+                options.type = KeyType::Pinyin;
+            } else if (std::string_view(optarg) == "table") {
+                options.type = KeyType::Table;
+            } else {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'd':
+            if (std::string_view(optarg) == "zipf") {
+                options.distribution = Distribution::Zipf;
+            } else if (std::string_view(optarg) == "uniform") {
+                options.distribution = Distribution::Uniform;
+            } else {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'z':
+            options.zipfExponent = std::strtod(optarg, nullptr);
+            break;
+        case 's':
+            options.seed = std::strtoul(optarg, nullptr, 10);
+            break;
+        default:
+            usage(argv[0]);
+            return c == 'h' ? 0 : 1;
+        }
+    }
+    if (!options.keys) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    auto keys = generateKeys(options);
+    std::mt19937 engine(options.seed + 1);
+    // Generated keys are in random order, so the query of a rank is the key
+    // at that index.
+    std::vector<size_t> queries(options.queries);
+    if (options.distribution == Distribution::Zipf) {
+        ZipfDistribution rank(keys.size(), options.zipfExponent);
+        for (auto &query : queries) {
+            query = rank(engine);
+        }
+    } else {
+        std::uniform_int_distribution<size_t> rank(0, keys.size() - 1);
+        for (auto &query : queries) {
+            query = rank(engine);
+        }
+    }
+
+    TestTrie trie;
+    runLatencyPhase("insert", keys.size(), [&trie, &keys](size_t i) {
+        trie.set(keys[i], static_cast<int32_t>(i));
     });
+    FCITX_ASSERT(trie.size() == keys.size());
+    reportMemory("insert", trie);
+
+    std::vector<std::string> sortedKeys = keys;
+    std::ranges::sort(sortedKeys);
+    {
+        std::vector<std::pair<std::string_view, int32_t>> entries;
+        entries.reserve(sortedKeys.size());
+        for (const auto &key : sortedKeys) {
+            entries.emplace_back(key, 0);
+        }
+        TestTrie built;
+        runPhase("build", entries.size(),
+                 [&built, &entries]() { built.build(entries); });
+        FCITX_ASSERT(built.size() == keys.size());
+        reportMemory("build", built);
+    }
+
+    size_t found = 0;
+    runLatencyPhase("exact_random", queries.size(),
+                    [&trie, &keys, &queries, &found](size_t i) {
+                        found += TestTrie::isValid(
+                            trie.exactMatchSearch(keys[queries[i]]));
+                    });
+    FCITX_ASSERT(found == queries.size());
 
-    FCITX_ASSERT(tree.size() == foreach_count);
+    found = 0;
+    runLatencyPhase("exact_sequential", sortedKeys.size(),
+                    [&trie, &sortedKeys, &found](size_t i) {
+                        found += TestTrie::isValid(
+                            trie.exactMatchSearch(sortedKeys[i]));
+                    });
+    FCITX_ASSERT(found == sortedKeys.size());
+
+    // Traverse byte by byte, like the key is typed.
+    found = 0;
+    runLatencyPhase("traverse", queries.size(),
+                    [&trie, &keys, &queries, &found](size_t i) {
+                        const auto &key = keys[queries[i]];
+                        TestTrie::position_type pos = 0;
+                        TestTrie::value_type value = 0;
+                        for (size_t j = 0; j < key.size(); j++) {
+                            value = trie.traverse(key.data() + j, 1, pos);
+                        }
+                        found += TestTrie::isValid(value);
+                    });
+    FCITX_ASSERT(found == queries.size());
+
+    // Search by code, which is the prefix before separator.
+    size_t matched = 0;
+    runLatencyPhase("foreach_prefix", queries.size(),
+                    [&trie, &keys, &queries, &matched](size_t i) {
+                        const auto &key = keys[queries[i]];
+                        trie.foreach(key.substr(0, key.find('\x01') + 1),
+                                     [&matched](int32_t, size_t,
+                                                TestTrie::position_type) {
+                                         matched++;
+                                         return true;
+                                     });
+                    });
+    FCITX_ASSERT(matched >= queries.size());
+
+    // Erase and insert back random keys.
+    const auto churn = std::min(queries.size(), keys.size());
+    runLatencyPhase("erase_churn", churn,
+                    [&trie, &keys, &queries](size_t i) {
+                        const auto &key = keys[queries[i]];
+                        if (trie.erase(key)) {
+                            trie.set(key, static_cast<int32_t>(queries[i]));
+                        }
+                    });
+    FCITX_ASSERT(trie.size() == keys.size());
+    reportMemory("erase_churn", trie);
+
+    std::stringstream ss;
+    runPhase("save", keys.size(), [&trie, &ss]() { trie.save(ss); });
+    TestTrie loaded;
+    runPhase("load", keys.size(), [&loaded, &ss]() { loaded.load(ss); });
+    FCITX_ASSERT(loaded.size() == keys.size());
+    for (size_t i = 0; i < keys.size(); i++) {
+        FCITX_ASSERT(loaded.exactMatchSearch(keys[i]) ==
+                     static_cast<int32_t>(i));
+    }
+    reportMemory("load", loaded);
 
     return 0;
 }
@@ -19,8 +19,9 @@
 namespace {
 
 void usage(const char *argv0) {
-    std::cout << "Usage: " << argv0 << " [-d] <source> <dest>\n"
+    std::cout << "Usage: " << argv0 << " [-di] <source> <dest>\n"
               << "-d: Dump binary to text\n"
+              << "-i: Save in uncompressed image format\n"
               << "-v: Show debug message\n"
               << "-h: Show this help\n";
 }
@@ -30,12 +31,16 @@ void usage(const char *argv0) {
 int main(int argc, char *argv[]) {
 
     bool dump = false;
+    bool image = false;
     int c;
-    while ((c = getopt(argc, argv, "dhv")) != -1) {
+    while ((c = getopt(argc, argv, "dhiv")) != -1) {
         switch (c) {
         case 'd':
             dump = true;
             break;
+        case 'i':
+            image = true;
+            break;
         case 'v':
             fcitx::Log::setLogRule("libime=5");
             break;
@@ -89,8 +94,13 @@ int main(int argc, char *argv[]) {
     }
 
     try {
-        dict.save(PinyinDictionary::SystemDict, *out,
-                  dump ? PinyinDictFormat::Text : PinyinDictFormat::Binary);
+        auto format = PinyinDictFormat::Binary;
+        if (dump) {
+            format = PinyinDictFormat::Text;
+        } else if (image) {
+            format = PinyinDictFormat::Image;
+        }
+        dict.save(PinyinDictionary::SystemDict, *out, format);
     } catch (const std::exception &e) {
         std::cerr << "Exception happened when saving output file " << outputFile
                   << ": " << e.what() << '\n';
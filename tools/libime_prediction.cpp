@@ -11,6 +11,7 @@
 #include <cstdint>
 #include <exception>
 #include <fstream>
+#include <functional>
 #include <iostream>
 #include <string>
 #include <string_view>
@@ -64,6 +65,7 @@ int parse(const char *modelFile, const char *arpa, const char *output,
     std::string lineBuf;
     std::unordered_map<std::string, std::unordered_map<std::string, float>>
         word;
+    std::vector<std::pair<std::string, float>> entries;
     int grams = -1;
     try {
         while (!in->eof()) {
@@ -116,9 +118,14 @@ int parse(const char *modelFile, const char *arpa, const char *output,
                 result.resize(maxSize);
             }
             for (auto &p2 : result) {
-                trie.set(p.first + "|" + p2.first, p2.second);
+                entries.emplace_back(p.first + "|" + p2.first, p2.second);
             }
         }
+        std::ranges::stable_sort(entries, std::less<>(),
+                                 &std::pair<std::string, float>::first);
+        std::vector<std::pair<std::string_view, float>> sortedEntries(
+            entries.begin(), entries.end());
+        trie.build(sortedEntries);
     } catch (const std::exception &e) {
         std::cerr << "Exception happened when parsing input file " << arpa
                   << ": " << e.what() << '\n';
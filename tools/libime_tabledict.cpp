@@ -18,11 +18,12 @@ namespace {
 
 void usage(const char *argv0) {
     std::cout
-        << "Usage: " << argv0 << " [-due] [-m <main dict>] <source> <dest>\n"
+        << "Usage: " << argv0 << " [-duei] [-m <main dict>] <source> <dest>\n"
         << "-d: Dump binary to text\n"
         << "-u: User dict\n"
         << "-e: Extra dict\n"
         << "-m <path/to/main.dict>: Main dict to be used with extra dict\n"
+        << "-i: Save main dict in uncompressed image format\n"
         << "-h: Show this help\n";
 }
 
@@ -33,9 +34,10 @@ int main(int argc, char *argv[]) {
     bool dump = false;
     bool user = false;
     bool extra = false;
+    bool image = false;
     std::optional<std::string> extraMain = std::nullopt;
     int c;
-    while ((c = getopt(argc, argv, "dhuem:")) != -1) {
+    while ((c = getopt(argc, argv, "dhueim:")) != -1) {
         switch (c) {
         case 'd':
             dump = true;
@@ -46,6 +48,9 @@ int main(int argc, char *argv[]) {
         case 'e':
             extra = true;
             break;
+        case 'i':
+            image = true;
+            break;
         case 'm':
             extraMain = std::string(optarg);
             break;
@@ -58,7 +63,7 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    if (optind + 2 != argc) {
+    if (optind + 2 != argc || (image && (user || extra))) {
         usage(argv[0]);
         return 1;
     }
@@ -66,7 +71,12 @@ int main(int argc, char *argv[]) {
     TableBasedDictionary dict;
 
     const auto inputFormat = dump ? TableFormat::Binary : TableFormat::Text;
-    const auto outputFormat = dump ? TableFormat::Text : TableFormat::Binary;
+    auto outputFormat = TableFormat::Binary;
+    if (dump) {
+        outputFormat = TableFormat::Text;
+    } else if (image) {
+        outputFormat = TableFormat::Image;
+    }
     size_t extraIndex = 0;
 
     try {